@@ -58,8 +58,19 @@
  *            |  trace off @ bnf_trace_off
  *            |  timing on @ bnf_timing_on
  *            |  timing off @ bnf_timing_off
+ *	      |  compile functions @ bnf_compile_functions
  *	      |  compile @ bnf_compile
  *            |  ? ? @ bnf_list
+ *            |  memo on @ bnf_memo_on
+ *            |  memo off @ bnf_memo_off
+ *            |  memo <identifier> @ bnf_memo
+ *            |  memo <integer> @ bnf_memo_size
+ *            |  earley <identifier> @ bnf_earley
+ *            |  depth <integer> @ bnf_depth
+ *            |  lexer <identifier> @ bnf_lexer
+ *            |  optimize on @ bnf_optimize_on
+ *            |  optimize off @ bnf_optimize_off
+ *            |  keywords <identifier> @ bnf_keywords
  *
  * - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
  * Grammar: Extended Backus Naur Form (EBNF)
@@ -94,9 +105,14 @@
  *             |  < <identifier> ? > @ bnf_zero_or_one
  *             |  < <identifier> * > @ bnf_zero_or_many
  *             |  < <identifier> + > @ bnf_one_or_many
+ *             |  < & <identifier> > @ bnf_and_predicate
+ *             |  < ! <identifier> > @ bnf_not_predicate
+ *             |  %left < <identifier> > @ bnf_left_operator
+ *             |  %right < <identifier> > @ bnf_right_operator
  *             |  ' <identifier> @ bnf_terminal
  *             |  <identifier> @ bnf_terminal
  *             |  @ <identifier> @ bnf_semantic
+ *             |  <regex> @ bnf_regex
  *             |  ' ' <token> @ bnf_terminal
  *             |  <token> @ bnf_terminal
  *
@@ -117,6 +133,11 @@
  *              |  <identifier> * @ bnf_zero_or_many
  *              |  <identifier> + @ bnf_one_or_many
  *              |  <identifier> @ bnf_non_terminal
+ *              |  %left <identifier> @ bnf_left_operator
+ *              |  %right <identifier> @ bnf_right_operator
+ *              |  <regex> @ bnf_regex
+ *              |  & <identifier> @ bnf_and_predicate
+ *              |  ! <identifier> @ bnf_not_predicate
  *
  * ----------------------------------------------------------------------
  */
@@ -147,6 +168,17 @@ extern TERM product_bnf_cmd_5[];
 extern TERM product_bnf_cmd_6[];
 extern TERM product_bnf_cmd_7[];
 extern TERM product_bnf_cmd_8[];
+extern TERM product_bnf_cmd_9[];
+extern TERM product_bnf_cmd_10[];
+extern TERM product_bnf_cmd_11[];
+extern TERM product_bnf_cmd_12[];
+extern TERM product_bnf_cmd_13[];
+extern TERM product_bnf_cmd_14[];
+extern TERM product_bnf_cmd_15[];
+extern TERM product_bnf_cmd_16[];
+extern TERM product_bnf_cmd_17[];
+extern TERM product_bnf_cmd_18[];
+extern TERM product_bnf_cmd_19[];
 
 extern PRODUCT syntax_ebnf[];
 extern TERM product_ebnf_1[];
@@ -186,6 +218,11 @@ extern TERM product_xbnf_term_6[];
 extern TERM product_xbnf_term_7[];
 extern TERM product_xbnf_term_8[];
 extern TERM product_xbnf_term_9[];
+extern TERM product_xbnf_term_10[];
+extern TERM product_xbnf_term_11[];
+extern TERM product_xbnf_term_12[];
+extern TERM product_xbnf_term_13[];
+extern TERM product_xbnf_term_14[];
 
 extern PRODUCT syntax_yacc[];
 extern TERM product_yacc_1[];
@@ -203,6 +240,11 @@ extern TERM product_yacc_term_3[];
 extern TERM product_yacc_term_4[];
 extern TERM product_yacc_term_5[];
 extern TERM product_yacc_term_6[];
+extern TERM product_yacc_term_7[];
+extern TERM product_yacc_term_8[];
+extern TERM product_yacc_term_9[];
+extern TERM product_yacc_term_10[];
+extern TERM product_yacc_term_11[];
 
 extern void semantic_bnf_first_product(ENVIRONMENT*);
 extern void semantic_bnf_next_product(ENVIRONMENT*);
@@ -220,6 +262,22 @@ extern void semantic_bnf_trace_on(ENVIRONMENT*);
 extern void semantic_bnf_trace_off(ENVIRONMENT*);
 extern void semantic_bnf_timing_on(ENVIRONMENT*);
 extern void semantic_bnf_timing_off(ENVIRONMENT*);
+extern void semantic_bnf_memo_on(ENVIRONMENT*);
+extern void semantic_bnf_memo_off(ENVIRONMENT*);
+extern void semantic_bnf_memo(ENVIRONMENT*);
+extern void semantic_bnf_earley(ENVIRONMENT*);
+extern void semantic_bnf_compile_functions(ENVIRONMENT*);
+extern void semantic_bnf_depth(ENVIRONMENT*);
+extern void semantic_bnf_left_operator(ENVIRONMENT*);
+extern void semantic_bnf_right_operator(ENVIRONMENT*);
+extern void semantic_bnf_regex(ENVIRONMENT*);
+extern void semantic_bnf_lexer(ENVIRONMENT*);
+extern void semantic_bnf_and_predicate(ENVIRONMENT*);
+extern void semantic_bnf_not_predicate(ENVIRONMENT*);
+extern void semantic_bnf_memo_size(ENVIRONMENT*);
+extern void semantic_bnf_optimize_on(ENVIRONMENT*);
+extern void semantic_bnf_optimize_off(ENVIRONMENT*);
+extern void semantic_bnf_keywords(ENVIRONMENT*);
 
 SYMBOL symbol_yacc = {
   &PARSE_LAST_SYMBOL, "yacc", 0, syntax_yacc, parse_syntax, NULL
@@ -343,8 +401,49 @@ SYMBOL symbol_compile = {
   &symbol_off, "compile", 0, NULL, parse_syntax, NULL
 };
 
+SYMBOL symbol_memo = {
+  &symbol_compile, "memo", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_earley = {
+  &symbol_memo, "earley", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_functions = {
+  &symbol_earley, "functions", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_depth = {
+  &symbol_functions, "depth", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_percent_left = {
+  &symbol_depth, "%left", 145, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_percent_right = {
+  &symbol_percent_left, "%right", 146, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_lexer = {
+  &symbol_percent_right, "lexer", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_optimize = {
+  &symbol_lexer, "optimize", 0, NULL, parse_syntax, NULL
+};
+
+SYMBOL symbol_keywords = {
+  &symbol_optimize, "keywords", 0, NULL, parse_syntax, NULL
+};
+
+#define symbol_ampersand symbol_token_147
+SYMBOL symbol_ampersand = {
+  &symbol_keywords, "&", 147, NULL, parse_syntax, NULL
+};
+
 SYMBOL symbol_yacc_product = {
-  &symbol_compile, "yacc_product", 0, syntax_yacc_product, parse_syntax, NULL
+  &symbol_ampersand, "yacc_product", 0, syntax_yacc_product, parse_syntax, NULL
 };
 
 SYMBOL symbol_yacc_term = {
@@ -443,7 +542,71 @@ SYMBOL symbol_bnf_timing_off = {
   &symbol_bnf_timing_on, "bnf_timing_off", 0, NULL, NULL, semantic_bnf_timing_off
 };
 
-#define BNF_LAST_SYMBOL symbol_bnf_timing_off
+SYMBOL symbol_bnf_memo_on = {
+  &symbol_bnf_timing_off, "bnf_memo_on", 0, NULL, NULL, semantic_bnf_memo_on
+};
+
+SYMBOL symbol_bnf_memo_off = {
+  &symbol_bnf_memo_on, "bnf_memo_off", 0, NULL, NULL, semantic_bnf_memo_off
+};
+
+SYMBOL symbol_bnf_memo = {
+  &symbol_bnf_memo_off, "bnf_memo", 0, NULL, NULL, semantic_bnf_memo
+};
+
+SYMBOL symbol_bnf_earley = {
+  &symbol_bnf_memo, "bnf_earley", 0, NULL, NULL, semantic_bnf_earley
+};
+
+SYMBOL symbol_bnf_compile_functions = {
+  &symbol_bnf_earley, "bnf_compile_functions", 0, NULL, NULL, semantic_bnf_compile_functions
+};
+
+SYMBOL symbol_bnf_depth = {
+  &symbol_bnf_compile_functions, "bnf_depth", 0, NULL, NULL, semantic_bnf_depth
+};
+
+SYMBOL symbol_bnf_left_operator = {
+  &symbol_bnf_depth, "bnf_left_operator", 0, NULL, NULL, semantic_bnf_left_operator
+};
+
+SYMBOL symbol_bnf_right_operator = {
+  &symbol_bnf_left_operator, "bnf_right_operator", 0, NULL, NULL, semantic_bnf_right_operator
+};
+
+SYMBOL symbol_bnf_regex = {
+  &symbol_bnf_right_operator, "bnf_regex", 0, NULL, NULL, semantic_bnf_regex
+};
+
+SYMBOL symbol_bnf_lexer = {
+  &symbol_bnf_regex, "bnf_lexer", 0, NULL, NULL, semantic_bnf_lexer
+};
+
+SYMBOL symbol_bnf_and_predicate = {
+  &symbol_bnf_lexer, "bnf_and_predicate", 0, NULL, NULL, semantic_bnf_and_predicate
+};
+
+SYMBOL symbol_bnf_not_predicate = {
+  &symbol_bnf_and_predicate, "bnf_not_predicate", 0, NULL, NULL, semantic_bnf_not_predicate
+};
+
+SYMBOL symbol_bnf_memo_size = {
+  &symbol_bnf_not_predicate, "bnf_memo_size", 0, NULL, NULL, semantic_bnf_memo_size
+};
+
+SYMBOL symbol_bnf_optimize_on = {
+  &symbol_bnf_memo_size, "bnf_optimize_on", 0, NULL, NULL, semantic_bnf_optimize_on
+};
+
+SYMBOL symbol_bnf_optimize_off = {
+  &symbol_bnf_optimize_on, "bnf_optimize_off", 0, NULL, NULL, semantic_bnf_optimize_off
+};
+
+SYMBOL symbol_bnf_keywords = {
+  &symbol_bnf_optimize_off, "bnf_keywords", 0, NULL, NULL, semantic_bnf_keywords
+};
+
+#define BNF_LAST_SYMBOL symbol_bnf_keywords
 
 /* 
  * ----------------------------------------------------------------------
@@ -469,8 +632,19 @@ SYMBOL symbol_bnf_timing_off = {
  *            |  trace off @ bnf_trace_off
  *            |  timing on @ bnf_timing_on
  *            |  timing off @ bnf_timing_off
+ *	      |  compile functions @ bnf_compile_functions
  *	      |  compile @ bnf_compile
  *            |  ? ? @ bnf_list
+ *            |  memo on @ bnf_memo_on
+ *            |  memo off @ bnf_memo_off
+ *            |  memo <identifier> @ bnf_memo
+ *            |  memo <integer> @ bnf_memo_size
+ *            |  earley <identifier> @ bnf_earley
+ *            |  depth <integer> @ bnf_depth
+ *            |  lexer <identifier> @ bnf_lexer
+ *            |  optimize on @ bnf_optimize_on
+ *            |  optimize off @ bnf_optimize_off
+ *            |  keywords <identifier> @ bnf_keywords
  *
  * ----------------------------------------------------------------------
  */
@@ -575,6 +749,17 @@ PRODUCT syntax_bnf_cmd[] = {
   product_bnf_cmd_6,
   product_bnf_cmd_7,
   product_bnf_cmd_8,
+  product_bnf_cmd_9,
+  product_bnf_cmd_10,
+  product_bnf_cmd_11,
+  product_bnf_cmd_12,
+  product_bnf_cmd_13,
+  product_bnf_cmd_14,
+  product_bnf_cmd_15,
+  product_bnf_cmd_16,
+  product_bnf_cmd_17,
+  product_bnf_cmd_18,
+  product_bnf_cmd_19,
   NULL
 };
 
@@ -616,15 +801,81 @@ TERM product_bnf_cmd_6[] = {
 
 TERM product_bnf_cmd_7[] = {
   { TERM_TERMINAL_TYPE, &symbol_compile },
-  { TERM_PRODUCT_END_TYPE, &symbol_bnf_compile }
+  { TERM_TERMINAL_TYPE, &symbol_functions },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_compile_functions }
 };
 
 TERM product_bnf_cmd_8[] = {
+  { TERM_TERMINAL_TYPE, &symbol_compile },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_compile }
+};
+
+TERM product_bnf_cmd_9[] = {
   { TERM_TERMINAL_TYPE, &symbol_question },
   { TERM_TERMINAL_TYPE, &symbol_question },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_list }
 };
 
+TERM product_bnf_cmd_10[] = {
+  { TERM_TERMINAL_TYPE, &symbol_memo },
+  { TERM_TERMINAL_TYPE, &symbol_on },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_memo_on }
+};
+
+TERM product_bnf_cmd_11[] = {
+  { TERM_TERMINAL_TYPE, &symbol_memo },
+  { TERM_TERMINAL_TYPE, &symbol_off },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_memo_off }
+};
+
+TERM product_bnf_cmd_12[] = {
+  { TERM_TERMINAL_TYPE, &symbol_memo },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_memo }
+};
+
+TERM product_bnf_cmd_13[] = {
+  { TERM_TERMINAL_TYPE, &symbol_earley },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_earley }
+};
+
+TERM product_bnf_cmd_14[] = {
+  { TERM_TERMINAL_TYPE, &symbol_depth },
+  { TERM_NON_TERMINAL_TYPE, &symbol_integer },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_depth }
+};
+
+TERM product_bnf_cmd_15[] = {
+  { TERM_TERMINAL_TYPE, &symbol_lexer },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_lexer }
+};
+
+TERM product_bnf_cmd_16[] = {
+  { TERM_TERMINAL_TYPE, &symbol_memo },
+  { TERM_NON_TERMINAL_TYPE, &symbol_integer },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_memo_size }
+};
+
+TERM product_bnf_cmd_17[] = {
+  { TERM_TERMINAL_TYPE, &symbol_optimize },
+  { TERM_TERMINAL_TYPE, &symbol_on },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_optimize_on }
+};
+
+TERM product_bnf_cmd_18[] = {
+  { TERM_TERMINAL_TYPE, &symbol_optimize },
+  { TERM_TERMINAL_TYPE, &symbol_off },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_optimize_off }
+};
+
+TERM product_bnf_cmd_19[] = {
+  { TERM_TERMINAL_TYPE, &symbol_keywords },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_keywords }
+};
+
 /* 
  * ----------------------------------------------------------------------
  * Grammar: Extended Backus Naur Form (EBNF)
@@ -774,9 +1025,14 @@ TERM product_ebnf_term_8[] = {
  *             |  < <identifier> ? > @ bnf_zero_or_one
  *             |  < <identifier> * > @ bnf_zero_or_many
  *             |  < <identifier> + > @ bnf_one_or_many
+ *             |  < & <identifier> > @ bnf_and_predicate
+ *             |  < ! <identifier> > @ bnf_not_predicate
+ *             |  %left < <identifier> > @ bnf_left_operator
+ *             |  %right < <identifier> > @ bnf_right_operator
  *             |  ' <identifier> @ bnf_terminal
  *             |  <identifier> @ bnf_terminal
  *             |  @ <identifier> @ bnf_semantic
+ *             |  <regex> @ bnf_regex
  *             |  ' ' <token> @ bnf_terminal
  *             |  <token> @ bnf_terminal
  *
@@ -839,6 +1095,11 @@ PRODUCT syntax_xbnf_term[] = {
   product_xbnf_term_7,
   product_xbnf_term_8,
   product_xbnf_term_9,
+  product_xbnf_term_10,
+  product_xbnf_term_11,
+  product_xbnf_term_12,
+  product_xbnf_term_13,
+  product_xbnf_term_14,
   NULL
 };
       
@@ -874,29 +1135,66 @@ TERM product_xbnf_term_4[] = {
 };
 
 TERM product_xbnf_term_5[] = {
+  { TERM_TERMINAL_TYPE, &symbol_less_than },
+  { TERM_TERMINAL_TYPE, &symbol_ampersand },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_TERMINAL_TYPE, &symbol_greater_than },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_and_predicate }
+};
+
+TERM product_xbnf_term_6[] = {
+  { TERM_TERMINAL_TYPE, &symbol_less_than },
+  { TERM_TERMINAL_TYPE, &symbol_exclamation },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_TERMINAL_TYPE, &symbol_greater_than },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_not_predicate }
+};
+
+TERM product_xbnf_term_7[] = {
+  { TERM_TERMINAL_TYPE, &symbol_percent_left },
+  { TERM_TERMINAL_TYPE, &symbol_less_than },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_TERMINAL_TYPE, &symbol_greater_than },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_left_operator }
+};
+
+TERM product_xbnf_term_8[] = {
+  { TERM_TERMINAL_TYPE, &symbol_percent_right },
+  { TERM_TERMINAL_TYPE, &symbol_less_than },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_TERMINAL_TYPE, &symbol_greater_than },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_right_operator }
+};
+
+TERM product_xbnf_term_9[] = {
   { TERM_TERMINAL_TYPE, &symbol_quote },
   { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_terminal }
 };
 
-TERM product_xbnf_term_6[] = {
+TERM product_xbnf_term_10[] = {
   { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_terminal }
 };
 
-TERM product_xbnf_term_7[] = {
+TERM product_xbnf_term_11[] = {
   { TERM_TERMINAL_TYPE, &symbol_at },
   { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_semantic }
 };
 
-TERM product_xbnf_term_8[] = {
+TERM product_xbnf_term_12[] = {
+  { TERM_NON_TERMINAL_TYPE, &symbol_regex },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_regex }
+};
+
+TERM product_xbnf_term_13[] = {
   { TERM_TERMINAL_TYPE, &symbol_quote },
   { TERM_NON_TERMINAL_TYPE, &symbol_token },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_terminal }
 };
 
-TERM product_xbnf_term_9[] = {
+TERM product_xbnf_term_14[] = {
   { TERM_NON_TERMINAL_TYPE, &symbol_token },
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_terminal }
 };
@@ -919,6 +1217,11 @@ TERM product_xbnf_term_9[] = {
  *              |  <identifier> * @ bnf_zero_or_many
  *              |  <identifier> + @ bnf_one_or_many
  *              |  <identifier> @ bnf_non_terminal
+ *              |  %left <identifier> @ bnf_left_operator
+ *              |  %right <identifier> @ bnf_right_operator
+ *              |  <regex> @ bnf_regex
+ *              |  & <identifier> @ bnf_and_predicate
+ *              |  ! <identifier> @ bnf_not_predicate
  *
  * ----------------------------------------------------------------------
  */
@@ -974,6 +1277,11 @@ PRODUCT syntax_yacc_term[] = {
   product_yacc_term_4,
   product_yacc_term_5,
   product_yacc_term_6,
+  product_yacc_term_7,
+  product_yacc_term_8,
+  product_yacc_term_9,
+  product_yacc_term_10,
+  product_yacc_term_11,
   NULL
 };
       
@@ -996,8 +1304,8 @@ TERM product_yacc_term_3[] = {
 
 TERM product_yacc_term_4[] = {
   { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
-  { TERM_TERMINAL_TYPE, &symbol_plus },
-  { TERM_PRODUCT_END_TYPE, &symbol_bnf_one_or_many }
+  { TERM_TERMINAL_TYPE, &symbol_times },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_zero_or_many }
 };
 
 TERM product_yacc_term_5[] = {
@@ -1011,6 +1319,35 @@ TERM product_yacc_term_6[] = {
   { TERM_PRODUCT_END_TYPE, &symbol_bnf_non_terminal }
 };
 
+TERM product_yacc_term_7[] = {
+  { TERM_TERMINAL_TYPE, &symbol_percent_left },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_left_operator }
+};
+
+TERM product_yacc_term_8[] = {
+  { TERM_TERMINAL_TYPE, &symbol_percent_right },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_right_operator }
+};
+
+TERM product_yacc_term_9[] = {
+  { TERM_NON_TERMINAL_TYPE, &symbol_regex },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_regex }
+};
+
+TERM product_yacc_term_10[] = {
+  { TERM_TERMINAL_TYPE, &symbol_ampersand },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_and_predicate }
+};
+
+TERM product_yacc_term_11[] = {
+  { TERM_TERMINAL_TYPE, &symbol_exclamation },
+  { TERM_NON_TERMINAL_TYPE, &symbol_identifier },
+  { TERM_PRODUCT_END_TYPE, &symbol_bnf_not_predicate }
+};
+
 /* 
  * ----------------------------------------------------------------------
  * Section: Extended Backup-Naur Form semantics and local variables
@@ -1022,6 +1359,17 @@ static SYMBOL *bnf_symbol = NULL;
 static TERM bnf_term[32];
 static int bnf_terms = 0;
 static int bnf_compile_id = 256;
+static int bnf_memoizing = FALSE;
+static int bnf_optimizing = TRUE;
+static SYMBOL **bnf_visited = NULL;
+static int bnf_visited_size = 0;
+static int bnf_visits = 0;
+static SYMBOL **bnf_plain = NULL;
+static int bnf_plain_size = 0;
+static int bnf_plains = 0;
+
+/* Maximum number of terms of an inlined symbol */
+#define BNF_INLINE_MAX 4
 
 SYMBOL *bnf_symbol_lookup(ENVIRONMENT *env, DICTIONARY *dictionary)
 {
@@ -1053,6 +1401,34 @@ SYMBOL *bnf_generate(TERM_TYPE type, ENVIRONMENT *env)
   return (symbol);
 }
 
+char *bnf_parse_name(SYMBOL *symbol)
+{
+  if (symbol->parse == parse_memo)
+    return ("parse_memo");
+  if (symbol->parse == parse_left_recursive)
+    return ("parse_left_recursive");
+  if (symbol->parse == parse_predict)
+    return ("parse_predict");
+  if (symbol->parse == parse_earley)
+    return ("parse_earley");
+  if (symbol->parse == parse_lalr)
+    return ("parse_lalr");
+  if (symbol->parse == parse_operator)
+    return ("parse_operator");
+  return ("parse_syntax");
+}
+
+static char *bnf_c_name(SYMBOL *symbol)
+{
+  static char name[32];
+
+  /* Helper symbols are numbered; their names are not C identifiers */
+  if (symbol->id == 0)
+    return (symbol->name);
+  sprintf(name, "token_%d", symbol->id);
+  return (name);
+}
+
 void bnf_display(SYMBOL *symbol)
 {
   PRODUCT *product;
@@ -1062,6 +1438,7 @@ void bnf_display(SYMBOL *symbol)
   
   /* Dump syntax definition */
   if (symbol->syntax != NULL) {
+    parse_prepare(symbol);
     printf("<%s> ::=", symbol->name);
     indent = strlen(symbol->name) + 4;
     for (product = symbol->syntax; *product; product++) {
@@ -1073,7 +1450,10 @@ void bnf_display(SYMBOL *symbol)
 	    printf(" %s", term->symbol->name);
 	    break;
 	  case TERM_NON_TERMINAL_TYPE:
-	    printf(" <%s>", term->symbol->name);
+	    if (term->symbol->dfa != NULL)
+	      printf(" %s", term->symbol->name);
+	    else
+	      printf(" <%s>", term->symbol->name);
 	    break;
 	  case TERM_ZERO_OR_ONE_TYPE:
 	    printf(" <%s?>", term->symbol->name);
@@ -1084,10 +1464,24 @@ void bnf_display(SYMBOL *symbol)
 	  case TERM_ONE_OR_MANY_TYPE:
 	    printf(" <%s+>", term->symbol->name);
 	    break;
+	  case TERM_LEFT_OPERATOR_TYPE:
+	    printf(" %%left <%s>", term->symbol->name);
+	    break;
+	  case TERM_RIGHT_OPERATOR_TYPE:
+	    printf(" %%right <%s>", term->symbol->name);
+	    break;
+	  case TERM_AND_PREDICATE_TYPE:
+	    printf(" <&%s>", term->symbol->name);
+	    break;
+	  case TERM_NOT_PREDICATE_TYPE:
+	    printf(" <!%s>", term->symbol->name);
+	    break;
 	  default:
 		break;
 	}
       }
+      if (term == *product)
+	printf(" <empty>");
       if (term->symbol != NULL)
 	printf(" @ %s", term->symbol->name);
       printf("\n");
@@ -1103,9 +1497,45 @@ void bnf_display(SYMBOL *symbol)
   if (symbol->semantic != NULL)
     printf("extern void semantic_%s(ENVIRONMENT*);\n", symbol->name);
 
-  /* Dump parse definition */
-  if (symbol->parse != parse_syntax && symbol->parse != NULL)
-    printf("extern int parse_%s(SYMBOL*, char**, VALUE**);\n", symbol->name);
+  /* Dump parse definition and LL(1) or LALR(1) conflicts */
+  if (symbol->syntax != NULL) {
+    if (symbol->parse != parse_syntax)
+      printf("# %s\n", bnf_parse_name(symbol));
+    if (symbol->parse == parse_lalr) {
+      n = parse_conflicts(symbol);
+      if (n < 0)
+	printf("# LALR(1) not applicable; back-tracking\n");
+      else if (n > 0)
+	printf("# LALR(1) conflicts: %d\n", n);
+      return;
+    }
+    n = symbol->conflict - 1;
+    if (n == 0)
+      printf("# LL(1) conflict at end of input\n");
+    else if (n > ' ' && n <= '~')
+      printf("# LL(1) conflict on '%c'\n", n);
+    else if (n > 0)
+      printf("# LL(1) conflict on 0x%02x\n", n);
+
+    /* Products committed to when a prefix has matched */
+    for (product = symbol->syntax; *product != NULL; product++) {
+      n = parse_commit(symbol, product - symbol->syntax);
+      if (n == 0)
+	continue;
+      term = *product + n - 1;
+      printf("# implicit cut in product %d after ", (int) (product - symbol->syntax) + 1);
+      if (term->type == TERM_TERMINAL_TYPE)
+	printf("\"%s\"\n", term->symbol->name);
+      else if (term->type == TERM_ONE_OR_MANY_TYPE)
+	printf("<%s+>\n", term->symbol->name);
+      else
+	printf("<%s>\n", term->symbol->name);
+    }
+  }
+  else if (symbol->dfa != NULL)
+    printf("# parse_dfa: %d states, %d classes\n", symbol->dfa->states, symbol->dfa->classes);
+  else if (symbol->parse != parse_syntax && symbol->parse != NULL)
+    printf("extern int parse_%s(PARSER*, SYMBOL*, char**, VALUE**);\n", symbol->name);
 }
 
 void bnf_list(void)
@@ -1136,13 +1566,294 @@ void bnf_list(void)
   }
 }
 
-void bnf_compile(void)
+static struct {
+  PARSE parse;
+  char *name;
+} bnf_primitive[] = {
+  { parse_empty, "parse_empty" },
+  { parse_eoln, "parse_eoln" },
+  { parse_integer, "parse_integer" },
+  { parse_float, "parse_float" },
+  { parse_string, "parse_string" },
+  { parse_identifier, "parse_identifier" },
+  { parse_token, "parse_token" },
+  { parse_nospace, "parse_nospace" },
+  { parse_space, "parse_space" },
+  { parse_cut, "parse_cut" },
+  { parse_throw, "parse_throw" },
+  { parse_run, "parse_run" },
+  { parse_pos, "parse_pos" },
+  { parse_regex, "parse_regex" },
+  { parse_dfa, "parse_dfa" },
+  { NULL, NULL }
+};
+
+static int bnf_direct(SYMBOL *symbol)
+{
+  PRODUCT *product;
+  TERM *term;
+
+  /* Symbols compiled to functions; back-tracking and predictive.
+     Operator tables are only parsed by parse_operator */
+  if (symbol->syntax == NULL ||
+      (symbol->parse != parse_syntax && symbol->parse != parse_predict))
+    return (FALSE);
+  for (product = symbol->syntax; *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+      if (TERM_OPERATOR(term->type))
+	return (FALSE);
+  return (TRUE);
+}
+
+static void bnf_compile_call(SYMBOL *symbol)
+{
+  int i;
+  
+  /* Call the parse function of the symbol directly */
+  if (bnf_direct(symbol))
+    printf("parse_syntax_%s", bnf_c_name(symbol));
+  else if (symbol->syntax != NULL)
+    printf("%s", bnf_parse_name(symbol));
+  else if (symbol->parse == parse_undefined)
+    printf("parse_%s", symbol->name);
+  else {
+    for (i = 0; bnf_primitive[i].parse != NULL; i++)
+      if (bnf_primitive[i].parse == symbol->parse)
+	break;
+    printf("%s", (bnf_primitive[i].name != NULL ? bnf_primitive[i].name : "parse_syntax"));
+  }
+  printf("(parser, &");
+  symbol_print_name(symbol);
+  printf(", input, output)");
+}
+
+static void bnf_compile_string(char *s)
+{
+  /* String literal with escaped quotes and back-slash */
+  putchar('"');
+  for (; *s != 0; s++) {
+    if (*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+static void bnf_compile_function(SYMBOL *symbol)
+{
+  PRODUCT *product;
+  TERM *term;
+  int n, length, jumps;
+  
+  /* One function per symbol; products are tried in order, except
+     that longer leading terminals are tried first (parse_order) */
+  parse_prepare(symbol);
+  printf("static int parse_syntax_%s(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)\n", bnf_c_name(symbol));
+  printf("{\n");
+  printf("  VALUE *old_output = *output;\n");
+  printf("  char *old_input = *input;\n");
+  printf("  int cutting = FALSE;\n");
+  printf("  int run;\n\n");
+  printf("  if (parse_tracing || parser->lexer != NULL)\n");
+  printf("    return (parse_syntax(parser, symbol, input, output));\n");
+  for (n = 1; symbol->syntax[n - 1] != NULL; n++) {
+    product = symbol->syntax + parse_order(symbol, n - 1);
+    printf("\n");
+    jumps = 0;
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+      switch (term->type) {
+      case TERM_TERMINAL_TYPE:
+	/* Identifiers may be keywords of the grammar; other strings
+	   are inlined */
+	if (parse_keyword(term->symbol->name)) {
+	  printf("  run = parse_symbol(parser, &");
+	  symbol_print_name(term->symbol);
+	  printf(", input, output);\n");
+	  break;
+	}
+	length = strlen(term->symbol->name);
+	printf("  parse_space(parser, symbol, input, output);\n");
+	if (length == 1) {
+	  printf("  run = (!parse_end(parser, *input) && **input == ");
+	  if (term->symbol->name[0] == '\'' || term->symbol->name[0] == '\\')
+	    printf("'\\%c');\n", term->symbol->name[0]);
+	  else
+	    printf("'%c');\n", term->symbol->name[0]);
+	  printf("  if (run)\n");
+	  printf("    *input += 1;\n");
+	  break;
+	}
+
+	/* Short input is left to parse_symbol; it advances the input */
+	printf("  if (parser->input_end - *input >= %d) {\n", length);
+	printf("    run = (memcmp(*input, ");
+	bnf_compile_string(term->symbol->name);
+	printf(", %d) == 0);\n", length);
+	printf("    if (run)\n");
+	printf("      *input += %d;\n", length);
+	printf("  }\n");
+	printf("  else\n");
+	printf("    run = parse_symbol(parser, &");
+	symbol_print_name(term->symbol);
+	printf(", input, output);\n");
+	break;
+      case TERM_NON_TERMINAL_TYPE:
+	if (term->symbol->parse == NULL) {
+	  printf("  return (FALSE);\n");
+	  continue;
+	}
+	if (term->symbol->parse == parse_cut) {
+	  printf("  cutting = TRUE;\n");
+	  printf("  parse_evict(parser, *input);\n");
+	  printf("  run = TRUE;\n");
+	  break;
+	}
+	printf("  run = ");
+	bnf_compile_call(term->symbol);
+	printf(";\n");
+	break;
+      case TERM_ZERO_OR_ONE_TYPE:
+	if (term->symbol->parse != NULL) {
+	  printf("  ");
+	  bnf_compile_call(term->symbol);
+	  printf(";\n");
+	}
+	printf("  run = TRUE;\n");
+	break;
+      case TERM_ZERO_OR_MANY_TYPE:
+      case TERM_ONE_OR_MANY_TYPE:
+	if (term->symbol->parse == NULL) {
+	  printf("  return (FALSE);\n");
+	  continue;
+	}
+	/* First iteration of one or many is unrolled */
+	if (term->type == TERM_ONE_OR_MANY_TYPE) {
+	  printf("  run = ");
+	  bnf_compile_call(term->symbol);
+	  printf(";\n");
+	  printf("  if (run)\n  ");
+	}
+	printf("  while (");
+	bnf_compile_call(term->symbol);
+	printf(");\n");
+	if (term->type == TERM_ZERO_OR_MANY_TYPE)
+	  printf("  run = TRUE;\n");
+	break;
+      case TERM_AND_PREDICATE_TYPE:
+      case TERM_NOT_PREDICATE_TYPE:
+	/* Lookahead; no cut or error position */
+	printf("  run = parse_lookahead(parser, %s, &",
+	       (term->type == TERM_AND_PREDICATE_TYPE ?
+		"TERM_AND_PREDICATE_TYPE" : "TERM_NOT_PREDICATE_TYPE"));
+	symbol_print_name(term->symbol);
+	printf(", *input, *output);\n");
+	printf("  if (!run)\n    goto fail_%d;\n", n);
+	jumps++;
+	continue;
+      case TERM_LEFT_OPERATOR_TYPE:
+      case TERM_RIGHT_OPERATOR_TYPE:
+	/* Symbols with operator tables are not compiled (bnf_direct) */
+	printf("  return (FALSE);\n");
+	continue;
+      case TERM_PRODUCT_END_TYPE:
+	break;
+      }
+
+      /* Check for cut and capture error position */
+      if (term->type != TERM_TERMINAL_TYPE) {
+	printf("  if (parser->cutting) {\n");
+	printf("    parser->cutting = FALSE;\n");
+	printf("    cutting = TRUE;\n");
+	printf("    parse_evict(parser, *input);\n");
+	printf("  }\n");
+      }
+      if (TERM_ERROR(term)->origin == NULL) {
+	printf("  if (*input >= parser->error_input) {\n");
+	printf("    parser->error_input = *input;\n");
+	printf("    parser->error_symbol = &");
+	symbol_print_name(TERM_ERROR(term));
+	printf(";\n");
+	printf("  }\n");
+      }
+      if (term->type != TERM_ZERO_OR_ONE_TYPE && term->type != TERM_ZERO_OR_MANY_TYPE) {
+	printf("  if (!run)\n    goto fail_%d;\n", n);
+	jumps++;
+      }
+
+      /* Implicit cut; the later products cannot match */
+      if (term - *product + 1 == parse_commit(symbol, product - symbol->syntax)) {
+	printf("  cutting = TRUE;\n");
+	printf("  parse_evict(parser, *input);\n");
+      }
+    }
+
+    /* Bind semantics with a direct store */
+    if (term->symbol != NULL) {
+      printf("  (*output)->type = VALUE_SYMBOL_TYPE;\n");
+      printf("  (*output)->view.as_symbol = &");
+      symbol_print_name(term->symbol);
+      printf(";\n");
+      printf("  *output = *output + 1;\n");
+    }
+    printf("  return (TRUE);\n");
+
+    /* Products without a failing term always match */
+    if (jumps == 0)
+      break;
+    printf(" fail_%d:\n", n);
+    printf("  *input = old_input;\n");
+    printf("  *output = old_output;\n");
+    printf("  if (cutting)\n");
+    printf("    return (FALSE);\n");
+  }
+  printf("  return (FALSE);\n");
+  printf("}\n\n");
+}
+
+static void bnf_compile_dfa(SYMBOL *symbol)
+{
+  DFA *dfa = symbol->dfa;
+  int n;
+
+  /* Byte class map, transitions per state and class, accept states */
+  printf("static unsigned char dfa_map_%d[] = {", symbol->id);
+  for (n = 0; n < 256; n++)
+    printf("%s%d", (n % 16 ? ", " : (n ? ",\n  " : "\n  ")), dfa->map[n]);
+  printf("\n};\n");
+  printf("static short dfa_next_%d[] = {", symbol->id);
+  for (n = 0; n < dfa->states * dfa->classes; n++)
+    printf("%s%d", (n % 16 ? ", " : (n ? ",\n  " : "\n  ")), dfa->next[n]);
+  printf("\n};\n");
+  printf("static unsigned char dfa_accept_%d[] = {", symbol->id);
+  for (n = 0; n < dfa->states; n++)
+    printf("%s%d", (n % 16 ? ", " : (n ? ",\n  " : "\n  ")), dfa->accept[n]);
+  printf("\n};\n");
+  printf("static DFA dfa_%d = {\n", symbol->id);
+  printf("  %d, %d, dfa_map_%d, dfa_next_%d, dfa_accept_%d\n",
+	 dfa->states, dfa->classes, symbol->id, symbol->id, symbol->id);
+  printf("};\n");
+}
+
+static void bnf_compile_term_end(TERM *term)
+{
+  /* Inlined terms carry the symbol reported in errors */
+  if (term->error != NULL) {
+    printf(", &");
+    symbol_print_name(term->error);
+  }
+  printf(" }, \n");
+}
+
+static void bnf_compile_output(int functions)
 {
   SYMBOL *symbol;
   PRODUCT *product;
   TERM *term;
   int n;
   
+  /* Complete the last definition and optimize the grammar */
+  bnf_optimize();
+
   /* The output might be used by C++ */
   printf("#if defined(__cplusplus)\n");
   printf("extern \"C\" {\n");
@@ -1158,16 +1869,19 @@ void bnf_compile(void)
   /* Compile forward references for grammar */
   for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next) {
     if (symbol->syntax != NULL) {
-      printf("extern PRODUCT syntax_%s[];\n", symbol->name);
+      printf("extern PRODUCT syntax_%s[];\n", bnf_c_name(symbol));
       for (n = 1, product = symbol->syntax; *product != NULL; product++, n++)
-	printf("extern TERM product_%s_%d[];\n", symbol->name, n);
+	printf("extern TERM product_%s_%d[];\n", bnf_c_name(symbol), n);
     }
   }
 
   /* Compile forward references on parse functions */
   for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next) {
     if (symbol->parse == parse_undefined) {
-      printf("extern int parse_%s(SYMBOL*, char**, VALUE**);\n", symbol->name);
+      printf("extern int parse_%s(PARSER*, SYMBOL*, char**, VALUE**);\n", symbol->name);
+    }
+    else if (functions && bnf_direct(symbol)) {
+      printf("static int parse_syntax_%s(PARSER*, SYMBOL*, char**, VALUE**);\n", bnf_c_name(symbol));
     }
   }
 
@@ -1178,68 +1892,102 @@ void bnf_compile(void)
     }
   }
 
+  /* Compile transition tables of regular expression terminals */
+  for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next)
+    if (symbol->dfa != NULL)
+      bnf_compile_dfa(symbol);
+
   /* Compile defined symbols */
   for (n= 1, symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next, n++) {
     printf("SYMBOL ");
     symbol_print_name(symbol);
     printf(" = {\n");
-    printf("  NULL, \"%s\", ", symbol->name);
+    printf("  NULL, ");
+    bnf_compile_string(symbol->name);
+    printf(", ");
     printf("%d, ", symbol->id);
     if (symbol->syntax != NULL) {
-      printf("syntax_%s, ", symbol->name);
-      printf("parse_syntax, ");
+      printf("syntax_%s, ", bnf_c_name(symbol));
+      if (functions && bnf_direct(symbol))
+	printf("parse_syntax_%s, ", bnf_c_name(symbol));
+      else
+	printf("%s, ", bnf_parse_name(symbol));
     } else {
       printf("NULL, ");
       if (symbol->parse == parse_undefined)
 	printf("parse_%s, ", symbol->name);
+      else if (symbol->dfa != NULL)
+	printf("parse_dfa, ");
       else
 	printf("parse_syntax, ");
     }
     if (symbol->semantic != NULL)
-      printf("semantic_%s\n", symbol->name);
+      printf("semantic_%s", symbol->name);
     else
-      printf("NULL\n");
-    printf("};\n");
+      printf("NULL");
+    if (symbol->dfa != NULL)
+      printf(", &dfa_%d", symbol->id);
+    printf("\n};\n");
   }
 
   /* Compile grammar */
   for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next) {
     if (symbol->syntax != NULL) {
 
-      printf("PRODUCT syntax_%s[] = {\n", symbol->name);
+      printf("PRODUCT syntax_%s[] = {\n", bnf_c_name(symbol));
       for (n = 1, product = symbol->syntax; *product != NULL; product++, n++)
-	printf("  product_%s_%d,\n", symbol->name, n);
+	printf("  product_%s_%d,\n", bnf_c_name(symbol), n);
       printf("  NULL\n");
       printf("};\n");
 
       for (n = 1, product = symbol->syntax; *product != NULL; product++, n++) {
-	printf("TERM product_%s_%d[] = {\n", symbol->name, n);
+	printf("TERM product_%s_%d[] = {\n", bnf_c_name(symbol), n);
 	for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
 	  switch (term->type) {
 	    case TERM_TERMINAL_TYPE:
 	      printf("  { TERM_TERMINAL_TYPE, &");
 	      symbol_print_name(term->symbol);
-	      printf(" }, \n");
+	      bnf_compile_term_end(term);
 	      break;
 	    case TERM_NON_TERMINAL_TYPE:
 	      printf("  { TERM_NON_TERMINAL_TYPE, &");
 	      symbol_print_name(term->symbol);
-	      printf(" }, \n");
+	      bnf_compile_term_end(term);
 	      break;
 	    case TERM_ZERO_OR_ONE_TYPE:
 	      printf("  { TERM_ZERO_OR_ONE_TYPE, &");
 	      symbol_print_name(term->symbol);
-	      printf(" }, \n");
+	      bnf_compile_term_end(term);
 	      break;
 	    case TERM_ZERO_OR_MANY_TYPE:
 	      printf("  { TERM_ZERO_OR_MANY_TYPE, &");
 	      symbol_print_name(term->symbol);
-	      printf(" }, \n");
+	      bnf_compile_term_end(term);
 	      break;
 	    case TERM_ONE_OR_MANY_TYPE:
 	      printf("  { TERM_ONE_OR_MANY_TYPE, &");
 	      symbol_print_name(term->symbol);
-	      printf(" }, \n");
+	      bnf_compile_term_end(term);
+	      break;
+	    case TERM_LEFT_OPERATOR_TYPE:
+	      printf("  { TERM_LEFT_OPERATOR_TYPE, &");
+	      symbol_print_name(term->symbol);
+	      bnf_compile_term_end(term);
+	      break;
+	    case TERM_RIGHT_OPERATOR_TYPE:
+	      printf("  { TERM_RIGHT_OPERATOR_TYPE, &");
+	      symbol_print_name(term->symbol);
+	      bnf_compile_term_end(term);
+	      break;
+	    case TERM_AND_PREDICATE_TYPE:
+	      printf("  { TERM_AND_PREDICATE_TYPE, &");
+	      symbol_print_name(term->symbol);
+	      bnf_compile_term_end(term);
+	      break;
+	    case TERM_NOT_PREDICATE_TYPE:
+	      printf("  { TERM_NOT_PREDICATE_TYPE, &");
+	      symbol_print_name(term->symbol);
+	      bnf_compile_term_end(term);
 	      break;
 	  }
 	}
@@ -1255,18 +2003,438 @@ void bnf_compile(void)
     }
   }
 
+  /* Compile direct coded parse functions */
+  if (functions) {
+    printf("\n");
+    for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next)
+      if (bnf_direct(symbol))
+	bnf_compile_function(symbol);
+  }
+
   /* The output might be used by C++ */
   printf("#if defined(__cplusplus)\n");
   printf("};\n");
   printf("#endif\n");
 }
 
+void bnf_compile(void)
+{
+  bnf_compile_output(FALSE);
+}
+
+void bnf_compile_functions(void)
+{
+  bnf_compile_output(TRUE);
+}
+
+void bnf_recursion(SYMBOL *symbol)
+{
+  int i;
+  
+  /* Direct left recursion is parsed by growing a seed */
+  if (symbol->parse != parse_lalr &&
+      bnf_term[0].type != TERM_TERMINAL_TYPE &&
+      bnf_term[0].type != TERM_PRODUCT_END_TYPE &&
+      !TERM_PREDICATE(bnf_term[0].type) &&
+      bnf_term[0].symbol == symbol)
+    symbol->parse = parse_left_recursive;
+
+  /* Operator tables are parsed by precedence climbing */
+  for (i = 0; i < bnf_terms; i++)
+    if (TERM_OPERATOR(bnf_term[i].type))
+      symbol->parse = parse_operator;
+}
+
+static void bnf_invalidate(void)
+{
+  SYMBOL *symbol;
+
+  /* The grammar changed; the analysis of the user symbols is redone */
+  for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next)
+    parse_invalidate(symbol);
+}
+
+static int bnf_factorable(PRODUCT product)
+{
+  TERM *term;
+
+  /* Empty products and products with side effects are not factored */
+  if (product->type == TERM_PRODUCT_END_TYPE)
+    return (FALSE);
+  for (term = product; term->type != TERM_PRODUCT_END_TYPE; term++)
+    if (term->symbol == &symbol_cut ||
+	term->symbol == &symbol_error ||
+	term->symbol == &symbol_execute)
+      return (FALSE);
+  return (TRUE);
+}
+
+static int bnf_same_term(TERM *x, TERM *y)
+{
+  return (x->type != TERM_PRODUCT_END_TYPE &&
+	  x->type == y->type &&
+	  x->symbol == y->symbol);
+}
+
+static SYMBOL *bnf_helper(SYMBOL *symbol)
+{
+  char name[128];
+  SYMBOL *helper;
+  int n;
+
+  /* Synthesized symbols are named after the symbol they came from;
+     the space keeps the name out of the grammar language */
+  for (n = 1; ; n++) {
+    sprintf(name, "%.100s %d", symbol->name, n);
+    if (symbol_lookup(name, &bnf_compile_id, FALSE, &bnf_dictionary) == NULL)
+      break;
+  }
+  helper = symbol_lookup(name, &bnf_compile_id, TRUE, &bnf_dictionary);
+  helper->id = bnf_compile_id++;
+  helper->parse = symbol->parse;
+  helper->origin = symbol;
+  return (helper);
+}
+
+static int bnf_length(PRODUCT product)
+{
+  TERM *term;
+
+  for (term = product; term->type != TERM_PRODUCT_END_TYPE; term++);
+  return (term - product);
+}
+
+static PRODUCT bnf_product(TERM *x, int m, TERM *y, int n, SYMBOL *semantic)
+{
+  PRODUCT product;
+
+  /* Concatenate terms and terminate with the semantic action */
+  product = (TERM *) malloc((m + n + 1) * sizeof(TERM));
+  memcpy(product, x, m * sizeof(TERM));
+  if (n > 0)
+    memcpy(product + m, y, n * sizeof(TERM));
+  product[m + n].type = TERM_PRODUCT_END_TYPE;
+  product[m + n].symbol = semantic;
+  product[m + n].error = NULL;
+  return (product);
+}
+
+static int bnf_backtracking(SYMBOL *symbol)
+{
+  return (symbol != NULL && symbol->syntax != NULL &&
+	  (symbol->parse == parse_syntax ||
+	   symbol->parse == parse_predict ||
+	   symbol->parse == parse_memo));
+}
+
+void bnf_factor(SYMBOL *symbol)
+{
+  PRODUCT *syntax;
+  PRODUCT *product;
+  SYMBOL *helper;
+  TERM call;
+  int count;
+  int i, j, k, l, m, n;
+
+  /* Factor symbols parsed by back-tracking; not left recursion, LALR, etc */
+  if (!bnf_optimizing || !bnf_backtracking(symbol))
+    return;
+  for (count = 0, product = symbol->syntax; *product != NULL; product++)
+    count++;
+  product = symbol->syntax;
+  syntax = (PRODUCT *) malloc((count + 1) * sizeof(PRODUCT));
+  for (i = 0, n = 0; i < count; i = j) {
+
+    /* Group adjacent products that start with the same term */
+    j = i + 1;
+    if (bnf_factorable(product[i]))
+      while (j < count &&
+	     bnf_factorable(product[j]) &&
+	     bnf_same_term(product[i], product[j]))
+	j++;
+    if (j - i < 2) {
+      syntax[n++] = product[i];
+      continue;
+    }
+
+    /* Length of the common prefix of the group */
+    for (k = 1; ; k++) {
+      for (m = i + 1; m < j; m++)
+	if (!bnf_same_term(&product[i][k], &product[m][k]))
+	  break;
+      if (m < j)
+	break;
+    }
+
+    /* Synthesize a helper symbol with the suffixes; semantics are kept */
+    helper = bnf_helper(symbol);
+    helper->syntax = (PRODUCT *) malloc((j - i + 1) * sizeof(PRODUCT));
+    for (m = i; m < j; m++) {
+      l = bnf_length(product[m]);
+      helper->syntax[m - i] = bnf_product(&product[m][k], l - k, NULL, 0,
+					   product[m][l].symbol);
+    }
+    helper->syntax[j - i] = NULL;
+
+    /* The group is replaced by the prefix and the helper */
+    call.type = TERM_NON_TERMINAL_TYPE;
+    call.symbol = helper;
+    call.error = NULL;
+    syntax[n++] = bnf_product(product[i], k, &call, 1, NULL);
+    for (m = i; m < j; m++)
+      free(product[m]);
+    bnf_factor(helper);
+  }
+  syntax[n] = NULL;
+  if (n == count) {
+    free(syntax);
+    return;
+  }
+  free(symbol->syntax);
+  symbol->syntax = syntax;
+  bnf_invalidate();
+}
+static int bnf_tail(SYMBOL *symbol, SYMBOL *recursive)
+{
+  PRODUCT *product;
+  TERM *term;
+  int n, l;
+
+  /* Products that end with the recursive symbol followed by an empty product */
+  for (n = 0, product = symbol->syntax; product[1] != NULL; product++, n++) {
+    l = bnf_length(*product);
+    if (!bnf_factorable(*product) ||
+	(*product)[l].symbol != NULL ||
+	(*product)[l - 1].type != TERM_NON_TERMINAL_TYPE ||
+	(*product)[l - 1].symbol != recursive)
+      return (0);
+  }
+  for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+    if (term->type != TERM_NON_TERMINAL_TYPE || term->symbol != &symbol_empty)
+      return (0);
+  return (n);
+}
+
+static void bnf_iterate(SYMBOL *symbol)
+{
+  PRODUCT *syntax;
+  PRODUCT product;
+  PRODUCT recursive;
+  SYMBOL *semantic;
+  SYMBOL *helper;
+  TERM loop;
+  int i, l, n;
+
+  if (!bnf_backtracking(symbol))
+    return;
+
+  /* <s> ::= a <s> | b <s> | @ x  gives  <s> ::= <s_n*> @ x, <s_n> ::= a | b */
+  syntax = symbol->syntax;
+  n = bnf_tail(symbol, symbol);
+  if (n > 0) {
+    for (i = 0; i < n; i++)
+      if (bnf_length(syntax[i]) < 2)
+	return;
+    helper = bnf_helper(symbol);
+    helper->syntax = (PRODUCT *) malloc((n + 1) * sizeof(PRODUCT));
+    for (i = 0; i < n; i++) {
+      helper->syntax[i] = bnf_product(syntax[i], bnf_length(syntax[i]) - 1, NULL, 0, NULL);
+      free(syntax[i]);
+    }
+    helper->syntax[n] = NULL;
+    semantic = syntax[n][bnf_length(syntax[n])].symbol;
+    free(syntax[n]);
+    loop.type = TERM_ZERO_OR_MANY_TYPE;
+    loop.symbol = helper;
+    loop.error = NULL;
+    syntax[0] = bnf_product(&loop, 1, NULL, 0, semantic);
+    syntax[1] = NULL;
+    bnf_invalidate();
+    return;
+  }
+
+  /* <s> ::= b <s_1>, <s_1> ::= a <s> | @ x  gives  <s> ::= b <s_1*> @ x, <s_1> ::= a b */
+  if (syntax[1] != NULL || !bnf_factorable(syntax[0]))
+    return;
+  product = syntax[0];
+  l = bnf_length(product);
+  if (l < 2 || product[l].symbol != NULL ||
+      product[l - 1].type != TERM_NON_TERMINAL_TYPE ||
+      product[l - 1].symbol->origin != symbol ||
+      !bnf_backtracking(product[l - 1].symbol))
+    return;
+  helper = product[l - 1].symbol;
+  n = bnf_tail(helper, symbol);
+  if (n == 0)
+    return;
+  for (i = 0; i < n; i++) {
+    syntax = &helper->syntax[i];
+    recursive = *syntax;
+    *syntax = bnf_product(recursive, bnf_length(recursive) - 1, product, l - 1, NULL);
+    free(recursive);
+  }
+  semantic = helper->syntax[n][bnf_length(helper->syntax[n])].symbol;
+  free(helper->syntax[n]);
+  helper->syntax[n] = NULL;
+  loop.type = TERM_ZERO_OR_MANY_TYPE;
+  loop.symbol = helper;
+  loop.error = NULL;
+  symbol->syntax[0] = bnf_product(product, l - 1, &loop, 1, semantic);
+  free(product);
+  bnf_invalidate();
+}
+
+static int bnf_reaches(SYMBOL *symbol, SYMBOL *target)
+{
+  PRODUCT *product;
+  TERM *term;
+  int i;
+
+  /* Depth first search; symbols are visited once */
+  for (i = 0; i < bnf_visits; i++)
+    if (bnf_visited[i] == symbol)
+      return (FALSE);
+  if (bnf_visits == bnf_visited_size) {
+    bnf_visited_size = (bnf_visited_size == 0 ? 64 : bnf_visited_size * 2);
+    bnf_visited = (SYMBOL **) realloc(bnf_visited, bnf_visited_size * sizeof(SYMBOL*));
+  }
+  bnf_visited[bnf_visits++] = symbol;
+  if (symbol->syntax == NULL)
+    return (FALSE);
+  for (product = symbol->syntax; *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+      if (term->symbol == target || bnf_reaches(term->symbol, target))
+	return (TRUE);
+  return (FALSE);
+}
+
+static int bnf_inlinable(SYMBOL *symbol, SYMBOL *caller)
+{
+  PRODUCT product;
+
+  /* Small single product symbols without semantics and recursion */
+  if (symbol == caller ||
+      symbol->syntax == NULL ||
+      symbol->syntax[0] == NULL ||
+      symbol->syntax[1] != NULL ||
+      (symbol->parse != parse_syntax && symbol->parse != parse_predict))
+    return (FALSE);
+  product = symbol->syntax[0];
+  if (!bnf_factorable(product) ||
+      bnf_length(product) > BNF_INLINE_MAX ||
+      product[bnf_length(product)].symbol != NULL)
+    return (FALSE);
+  bnf_visits = 0;
+  if (bnf_reaches(symbol, symbol))
+    return (FALSE);
+  bnf_visits = 0;
+  return (!bnf_reaches(symbol, caller));
+}
+
+static void bnf_inline(SYMBOL *symbol)
+{
+  PRODUCT *product;
+  PRODUCT inlined;
+  SYMBOL *callee;
+  TERM *term;
+  int i, l, n;
+
+  if (!bnf_backtracking(symbol))
+    return;
+
+  /* Replace calls with the terms of the called symbol. A failure
+     at the start of the terms is reported for the called symbol */
+  for (product = symbol->syntax; *product != NULL; product++) {
+    l = bnf_length(*product);
+    for (i = 0; i < l; i++) {
+      callee = (*product)[i].symbol;
+      if ((*product)[i].type != TERM_NON_TERMINAL_TYPE ||
+	  !bnf_inlinable(callee, symbol))
+	continue;
+      n = bnf_length(callee->syntax[0]);
+      inlined = (TERM *) malloc((l + n) * sizeof(TERM));
+      memcpy(inlined, *product, i * sizeof(TERM));
+      memcpy(inlined + i, callee->syntax[0], n * sizeof(TERM));
+      memcpy(inlined + i + n, *product + i + 1, (l - i) * sizeof(TERM));
+      for (term = inlined + i; term < inlined + i + n; term++) {
+	term->error = callee;
+	if (term->type == TERM_TERMINAL_TYPE ||
+	    term->type == TERM_NON_TERMINAL_TYPE ||
+	    term->type == TERM_ONE_OR_MANY_TYPE)
+	  break;
+      }
+      free(*product);
+      *product = inlined;
+      l += n - 1;
+      i += n - 1;
+      bnf_invalidate();
+    }
+  }
+}
+
+static SYMBOL *bnf_root(SYMBOL *symbol)
+{
+  while (symbol->origin != NULL)
+    symbol = symbol->origin;
+  return (symbol);
+}
+
+static int bnf_optimized(SYMBOL *symbol)
+{
+  int i;
+
+  /* Symbols defined after optimize off are kept as written */
+  for (i = 0; i < bnf_plains; i++)
+    if (bnf_plain[i] == bnf_root(symbol))
+      return (FALSE);
+  return (TRUE);
+}
+
+static void bnf_complete(void)
+{
+  SYMBOL *symbol;
+
+  /* The last definition is complete; the rewrites only touch the
+     symbol and its helper symbols */
+  if (bnf_symbol == NULL)
+    return;
+  if (!bnf_optimizing) {
+    if (bnf_optimized(bnf_symbol)) {
+      if (bnf_plains == bnf_plain_size) {
+	bnf_plain_size = (bnf_plain_size == 0 ? 16 : bnf_plain_size * 2);
+	bnf_plain = (SYMBOL **) realloc(bnf_plain, bnf_plain_size * sizeof(SYMBOL*));
+      }
+      bnf_plain[bnf_plains++] = bnf_symbol;
+    }
+    return;
+  }
+  bnf_factor(bnf_symbol);
+  for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next)
+    if (bnf_root(symbol) == bnf_symbol)
+      bnf_iterate(symbol);
+}
+
+void bnf_optimize(void)
+{
+  SYMBOL *symbol;
+
+  /* Complete the last definition and inline; called symbols may be
+     defined after the symbols that use them */
+  bnf_complete();
+  for (symbol = bnf_dictionary; symbol != &symbol_bnf; symbol = symbol->next)
+    if (bnf_optimized(symbol))
+      bnf_inline(symbol);
+}
+
 void semantic_bnf_first_product(ENVIRONMENT *env)
 {
   SYMBOL *symbol = bnf_symbol_lookup(env, &bnf_dictionary);
   PRODUCT *product;
   int n;
   
+  /* The previous definition is complete; optimize it */
+  bnf_complete();
+
   /* Capture the definition symbol */
   bnf_symbol = symbol;
   if (symbol->syntax != NULL) {
@@ -1275,7 +2443,10 @@ void semantic_bnf_first_product(ENVIRONMENT *env)
 
   /* Allocate initial product vector */
   symbol->syntax = product = (PRODUCT *) malloc(2 * sizeof(PRODUCT));
-  symbol->parse = parse_syntax;
+  if (main_symbol == &symbol_yacc)
+    symbol->parse = parse_lalr;
+  else
+    symbol->parse = (bnf_memoizing ? parse_memo : parse_syntax);
   
   /* Terminate product without semantics */
   n = bnf_terms;
@@ -1289,6 +2460,8 @@ void semantic_bnf_first_product(ENVIRONMENT *env)
   product[0] = (TERM *) malloc(bnf_terms * sizeof(TERM));
   memcpy(product[0], bnf_term, bnf_terms * sizeof(TERM));
   product[1] = NULL;
+  bnf_recursion(symbol);
+  bnf_invalidate();
   bnf_terms = 0;
 }
 
@@ -1320,6 +2493,8 @@ void semantic_bnf_next_product(ENVIRONMENT *env)
   product[n - 1] = (TERM *) malloc(bnf_terms * sizeof(TERM));
   memcpy(product[n - 1], bnf_term, bnf_terms * sizeof(TERM));
   product[n] = NULL;
+  bnf_recursion(symbol);
+  bnf_invalidate();
   bnf_terms = 0;
 }
 
@@ -1343,11 +2518,45 @@ void semantic_bnf_one_or_many(ENVIRONMENT *env)
   bnf_generate(TERM_ONE_OR_MANY_TYPE, env);
 }
 
+void semantic_bnf_left_operator(ENVIRONMENT *env)
+{
+  bnf_generate(TERM_LEFT_OPERATOR_TYPE, env);
+}
+
+void semantic_bnf_right_operator(ENVIRONMENT *env)
+{
+  bnf_generate(TERM_RIGHT_OPERATOR_TYPE, env);
+}
+
+void semantic_bnf_and_predicate(ENVIRONMENT *env)
+{
+  bnf_generate(TERM_AND_PREDICATE_TYPE, env);
+}
+
+void semantic_bnf_not_predicate(ENVIRONMENT *env)
+{
+  bnf_generate(TERM_NOT_PREDICATE_TYPE, env);
+}
+
 void semantic_bnf_terminal(ENVIRONMENT *env)
 {
   bnf_generate(TERM_TERMINAL_TYPE, env);
 }
 
+void semantic_bnf_regex(ENVIRONMENT *env)
+{
+  SYMBOL *symbol = bnf_generate(TERM_NON_TERMINAL_TYPE, env);
+  int length = strlen(symbol->name);
+
+  /* Compile the pattern between the slashes once per symbol */
+  if (symbol->dfa == NULL)
+    symbol->dfa = parse_regex_compile(symbol->name + 1, length - 2);
+  if (symbol->dfa == NULL)
+    printf("%s: illegal regular expression\n", symbol->name);
+  else
+    symbol->parse = parse_dfa;
+}
+
 void semantic_bnf_semantic(ENVIRONMENT *env)
 {
   SYMBOL *symbol = bnf_generate(TERM_PRODUCT_END_TYPE, env);
@@ -1359,6 +2568,7 @@ SYMBOL *main_symbol;
 
 void semantic_bnf_execute(ENVIRONMENT *env)
 {
+  bnf_optimize();
   main_symbol = bnf_symbol_lookup(env, &bnf_dictionary);
   if (!strcmp(main_symbol->name, "shell"))
     exit(0);
@@ -1379,10 +2589,14 @@ void semantic_bnf_compile(ENVIRONMENT *env)
   bnf_compile();
 }
 
+void semantic_bnf_compile_functions(ENVIRONMENT *env)
+{
+  bnf_compile_functions();
+}
+
 void semantic_bnf_trace_on(ENVIRONMENT *env)
 {
   parse_tracing = TRUE;
-  parse_indent = 0;
 }
 
 void semantic_bnf_trace_off(ENVIRONMENT *env)
@@ -1400,4 +2614,93 @@ void semantic_bnf_timing_off(ENVIRONMENT *env)
   parse_timing = FALSE;
 }
 
+void semantic_bnf_memo_on(ENVIRONMENT *env)
+{
+  bnf_memoizing = TRUE;
+}
+
+void semantic_bnf_memo_off(ENVIRONMENT *env)
+{
+  bnf_memoizing = FALSE;
+}
+
+void semantic_bnf_optimize_on(ENVIRONMENT *env)
+{
+  bnf_complete();
+  bnf_symbol = NULL;
+  bnf_optimizing = TRUE;
+}
+
+void semantic_bnf_optimize_off(ENVIRONMENT *env)
+{
+  bnf_complete();
+  bnf_symbol = NULL;
+  bnf_optimizing = FALSE;
+}
+
+void semantic_bnf_memo(ENVIRONMENT *env)
+{
+  SYMBOL *symbol = bnf_symbol_lookup(env, &bnf_dictionary);
+
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    return;
+  }
+  if (symbol->parse == parse_syntax || symbol->parse == parse_predict)
+    symbol->parse = parse_memo;
+  bnf_invalidate();
+}
+
+void semantic_bnf_memo_size(ENVIRONMENT *env)
+{
+  VALUE *v;
+
+  value_pop(env, v);
+  parse_memo_size = v->view.as_long;
+}
+
+void semantic_bnf_earley(ENVIRONMENT *env)
+{
+  SYMBOL *symbol = bnf_symbol_lookup(env, &bnf_dictionary);
 
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    return;
+  }
+  if (symbol->parse == parse_operator) {
+    printf("<%s>: operator precedence\n", symbol->name);
+    return;
+  }
+  symbol->parse = parse_earley;
+  bnf_invalidate();
+}
+
+void semantic_bnf_depth(ENVIRONMENT *env)
+{
+  VALUE *v;
+
+  value_pop(env, v);
+  parse_depth = v->view.as_long;
+}
+
+void semantic_bnf_lexer(ENVIRONMENT *env)
+{
+  SYMBOL *symbol = bnf_symbol_lookup(env, &bnf_dictionary);
+
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    return;
+  }
+  parse_lexer(symbol);
+}
+
+void semantic_bnf_keywords(ENVIRONMENT *env)
+{
+  SYMBOL *symbol = bnf_symbol_lookup(env, &bnf_dictionary);
+
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    return;
+  }
+  parse_keywords(symbol);
+}
@@ -37,4 +37,15 @@ extern SYMBOL symbol_ebnf;
 extern SYMBOL symbol_xbnf;
 extern SYMBOL symbol_yacc;
 
+/* Compile the grammar to tables, or tables and parse functions */
+void bnf_compile(void);
+void bnf_compile_functions(void);
+
+/* Factor common prefixes of adjacent products into helper symbols */
+void bnf_factor(SYMBOL *symbol);
+
+/* Complete the last definition; factor, rewrite tail recursion to
+   iteration and inline small helper symbols */
+void bnf_optimize(void);
+
 #endif /* BNF_H */
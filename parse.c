@@ -27,7 +27,15 @@
  * ----------------------------------------------------------------------
  */
 
+/* strtod_l and newlocale from the GNU C library */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <locale.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,6 +45,20 @@
 #include "parse.h"
 #include "bnf.h"
 
+/* Vector scanning kernels with GCC on x86; SSE2 and AVX2 */
+#if defined(__GNUC__) && defined(__SSE2__) && !defined(PARSE_NO_SIMD)
+#define SCAN_SIMD
+#include <immintrin.h>
+#endif
+
+/* Float conversion with a C locale of its own; strtod_l */
+#if defined(__GNUC__) && (defined(__GLIBC__) || defined(__APPLE__)) && !defined(PARSE_NO_LOCALE)
+#define NUMBER_LOCALE
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+#endif
+
 #define CLK_TCK CLOCKS_PER_SEC
 
 /* 
@@ -142,7 +164,7 @@ SYMBOL *symbol_lookup(char *name, int *id, int append, DICTIONARY *dictionary)
   if (!append)
     return (NULL);
   
-  symbol = (SYMBOL *) malloc(sizeof(SYMBOL));
+  symbol = (SYMBOL *) calloc(1, sizeof(SYMBOL));
   symbol->next = *dictionary;
   symbol->name = (char*) strdup(name);
   if (isalpha(name[0]) || name[0] == '_')
@@ -186,14 +208,12 @@ void symbol_bind(SYMBOL *symbol, VALUE **output)
  * ----------------------------------------------------------------------
  */
 
-int parse_executing;
-
 void parse_execute(ENVIRONMENT *env)
 {
   if (env == NULL)
     return;
 
-  for (parse_executing = TRUE; parse_executing;) {
+  for (env->executing = TRUE; env->executing;) {
     switch (env->ip->type) {
       case VALUE_PTR_TYPE:
       case VALUE_STR_TYPE:  
@@ -212,10 +232,10 @@ void parse_execute(ENVIRONMENT *env)
 	env->ip++;
 	break;
       case VALUE_UNDEFINED_TYPE:
-	parse_executing = FALSE;
+	env->executing = FALSE;
 	break;
       default:
-	parse_executing = FALSE;
+	env->executing = FALSE;
 	printf("%d: unknown data type\n", env->ip->type);
 	break;
     }
@@ -228,441 +248,4464 @@ void parse_execute(ENVIRONMENT *env)
  * ----------------------------------------------------------------------
  */
 
-jmp_buf parse_catch_buf;
-SYMBOL *parse_error_symbol;
-char *parse_error_input;
 int parse_tracing = FALSE;
 int parse_timing = FALSE;
-int parse_warning = FALSE;
-int parse_indent = 0;
-int parse_cutting = FALSE;
+int parse_depth = PARSE_DEPTH;
+int parse_memo_size = PARSE_MEMO_MAX;
 #define INDENT_STEP 2
-static char *start_input;
-static VALUE *start_output;
 
-void parse_error(void)
+void parse_error(PARSER *parser)
 {
-  int i = parse_error_input - start_input;
+  SYMBOL *symbol = parser->error_symbol;
+  int i = parser->error_input - parser->start_input;
+
+  /* Report the symbol that factored products came from */
+  while (symbol->origin != NULL)
+    symbol = symbol->origin;
   while (i--)
     putchar(' ');
-  if (parse_error_symbol->syntax != NULL)
-    printf("^- <%s> expected\n", parse_error_symbol->name);
+  if (parser->overflow)
+    printf("^- nesting depth exceeded\n");
+  else if (parser->range_input == parser->error_input)
+    printf("^- number out of range\n");
+  else if (symbol->syntax != NULL)
+    printf("^- <%s> expected\n", symbol->name);
   else 
-    printf("^- \"%s\" expected\n", parse_error_symbol->name);
+    printf("^- \"%s\" expected\n", symbol->name);
 }
 
 /* 
  * ----------------------------------------------------------------------
- * Section: Top down parser
+ * Section: Packrat memoization (symbol and input position to result)
  * ----------------------------------------------------------------------
  */
 
-int parse_symbol(SYMBOL *symbol, char **input, VALUE **output)
-{
-  register char *ip;
-  register char *np;
-  
-  /* Parse white space */
-  parse_space(symbol, input, output);
-  if (**input == 0)
-    return (FALSE);
-
-  /* Match with the name string */
-  ip = *input;
-  np = symbol->name;
-  while (*np != 0 && *ip == *np) {
-    ip++;
-    np++;
-  }
-
-  /* If the match failed */
-  if (*np != 0) 
-    return (FALSE);
+struct MEMO {
+  MEMO *next;
+  MEMO *older;
+  MEMO *newer;
+  int growing;
+  SYMBOL *symbol;
+  char *input;
+  char *end;
+  SYMBOL *error_symbol;
+  char *error_input;
+  int count;
+  VALUE *code;
+};
 
-  *input = ip;
-  return (TRUE);
+static MEMO **memo_bucket(PARSER *parser, SYMBOL *symbol, char *input)
+{
+  unsigned long key = (unsigned long) (input - parser->start_input);
+  key = key * 31 + ((unsigned long) symbol >> 4);
+  return (&parser->memo[key % PARSE_MEMO_SIZE]);
 }
 
-int parse_syntax(SYMBOL *symbol, char **input, VALUE **output)
+MEMO *memo_lookup(PARSER *parser, SYMBOL *symbol, char *input)
 {
-  VALUE *old_output;
-  char *old_input;
-  PRODUCT *product;
-  TERM *term;
-  int cutting;
-  int run;
-  
-  /* Check that it at least has some products */
-  if (symbol->syntax == NULL) {
-    printf("<%s>: undefined\n", symbol->name);
-    parse_warning = TRUE;
-    return (FALSE);
-  }
-
-  /* Check for trace and step up indentation */
-  if (parse_tracing)
-    parse_indent += INDENT_STEP;
+  MEMO *memo;
 
-  /* Check each product. Backtrack if the product fails and no cut */
-  cutting = FALSE;
-  for (product = symbol->syntax; *product != NULL && !cutting; product++) {
-    old_input = *input;
-    old_output = *output;
-    
-    /* Check each term in the product */
-    for (run = TRUE, term = *product; run; term++) {
+  for (memo = *memo_bucket(parser, symbol, input); memo != NULL; memo = memo->next)
+    if (memo->symbol == symbol && memo->input == input)
+      return (memo);
+  return (NULL);
+}
 
-      /* Check for trace of parse */
-      if (parse_tracing && term->type != TERM_PRODUCT_END_TYPE) {
-	int n = parse_indent;
-	while (n--)
-	  putchar(' ');
-	if (term->type == TERM_TERMINAL_TYPE)
-	  printf("\"%s\"\n", term->symbol->name);
-	else 
-	  printf("<%s>\n", term->symbol->name);
-      }
-      
-      /* Decode type of term and apply */
-      switch (term->type) {
-	case TERM_TERMINAL_TYPE:
-	  run = parse_symbol(term->symbol, input, output);
-	  break;
-	case TERM_NON_TERMINAL_TYPE:
-	  if (term->symbol->parse == NULL)
-	    return (FALSE);
-	  run = term->symbol->parse(term->symbol, input, output);
-	  break;
-	case TERM_ZERO_OR_ONE_TYPE:
-	  if (term->symbol->parse != NULL)
-	    term->symbol->parse(term->symbol, input, output);
-	  break;
-	case TERM_ZERO_OR_MANY_TYPE:
-	  if (term->symbol->parse == NULL)
-	    return (FALSE);
-	  while (term->symbol->parse(term->symbol, input, output));
-	  break;
-	case TERM_ONE_OR_MANY_TYPE:
-	  if (term->symbol->parse == NULL)
-	    return (FALSE);
-	  run = term->symbol->parse(term->symbol, input, output);
-	  if (run)
-	    while (term->symbol->parse(term->symbol, input, output));
-	  break;
-	case TERM_PRODUCT_END_TYPE:
-	  symbol_bind(term->symbol, output);
-	  /* Step back indentation */
-	  if (parse_tracing)
-	    parse_indent -= INDENT_STEP;
-	  /* Parse was found */
-	  return (TRUE);
-      }
+static void memo_remove(PARSER *parser, MEMO *memo)
+{
+  MEMO **mp;
 
-      /* Check for cut */
-      if (parse_cutting) {
-	parse_cutting = FALSE;
-	cutting = TRUE;
-      }
+  /* Unlink from the bucket and the insertion order */
+  for (mp = memo_bucket(parser, memo->symbol, memo->input); *mp != memo; mp = &(*mp)->next);
+  *mp = memo->next;
+  if (memo->older != NULL)
+    memo->older->newer = memo->newer;
+  else
+    parser->memo_oldest = memo->newer;
+  if (memo->newer != NULL)
+    memo->newer->older = memo->older;
+  else
+    parser->memo_newest = memo->older;
+  parser->memo_count--;
+  if (memo->code != NULL)
+    free(memo->code);
+  free(memo);
+}
 
-      /* Capture error position */
-      if (*input >= parse_error_input) {
-	parse_error_input = *input;
-	parse_error_symbol = term->symbol;
-      }
-    }
+void parse_evict(PARSER *parser, char *input)
+{
+  MEMO *memo;
+  MEMO *newer;
+  char *low;
 
-    /* Back-track and try next product */
-    *input = old_input;
-    *output = old_output;
+  /* Cut; the results before the position are not used again. Seeds
+     of left recursion that are growing are kept */
+  if (parser->memo_low == NULL || parser->memo_low >= input)
+    return;
+  low = NULL;
+  for (memo = parser->memo_oldest; memo != NULL; memo = newer) {
+    newer = memo->newer;
+    if (memo->input < input && !memo->growing)
+      memo_remove(parser, memo);
+    else if (low == NULL || memo->input < low)
+      low = memo->input;
   }
-
-  /* Step back indentation */
-  if (parse_tracing)
-    parse_indent -= INDENT_STEP;
-
-  /* Parse failed */
-  return (FALSE);
+  parser->memo_low = low;
 }
 
-int parse_undefined(SYMBOL *symbol, char **input, VALUE **output)
+MEMO *memo_insert(PARSER *parser, SYMBOL *symbol, char *input)
 {
-  printf("<%s> undefined\n", symbol->name);
-  parse_warning = TRUE;
-  return (FALSE);
-}
+  MEMO **bucket;
+  MEMO *memo;
+  MEMO *oldest;
 
-int parse_empty(SYMBOL *symbol, char **input, VALUE **output)
-{
-  return (TRUE);
+  /* Drop the oldest results when the table is full */
+  oldest = parser->memo_oldest;
+  while (parse_memo_size > 0 && parser->memo_count >= parse_memo_size && oldest != NULL) {
+    memo = oldest;
+    oldest = oldest->newer;
+    if (!memo->growing)
+      memo_remove(parser, memo);
+  }
+
+  /* Insert a failed parse. Updated with memo_store() */
+  bucket = memo_bucket(parser, symbol, input);
+  memo = (MEMO *) malloc(sizeof(MEMO));
+  memo->next = *bucket;
+  memo->older = parser->memo_newest;
+  memo->newer = NULL;
+  memo->growing = FALSE;
+  if (parser->memo_newest != NULL)
+    parser->memo_newest->newer = memo;
+  else
+    parser->memo_oldest = memo;
+  parser->memo_newest = memo;
+  parser->memo_count++;
+  if (parser->memo_low == NULL || input < parser->memo_low)
+    parser->memo_low = input;
+  memo->symbol = symbol;
+  memo->input = input;
+  memo->end = NULL;
+  memo->error_symbol = parser->error_symbol;
+  memo->error_input = parser->error_input;
+  memo->count = 0;
+  memo->code = NULL;
+  *bucket = memo;
+
+  return (memo);
 }
 
-int parse_eoln(SYMBOL *symbol, char **input, VALUE **output)
+void memo_store(PARSER *parser, MEMO *memo, char *end, VALUE *code, int count)
 {
-  /* Parse white space */
-  parse_space(symbol, input, output);
-  return (**input == 0);
+  /* Capture the result, the emitted code and the error position */
+  memo->end = end;
+  memo->error_symbol = parser->error_symbol;
+  memo->error_input = parser->error_input;
+  memo->count = count;
+  if (memo->code != NULL)
+    free(memo->code);
+  memo->code = NULL;
+  if (count > 0) {
+    memo->code = (VALUE *) malloc(count * sizeof(VALUE));
+    memcpy(memo->code, code, count * sizeof(VALUE));
+  }
 }
 
-int parse_integer(SYMBOL *symbol, char **input, VALUE **output)
+int memo_replay(PARSER *parser, MEMO *memo, char **input, VALUE **output)
 {
-  VALUE v;
-  char *token;
-  char *endptr;
-
-  /* Scan for an integer value in input */
-  parse_space(symbol, input, output);
-  token = *input;
-  v.type = VALUE_LONG_TYPE;
-  v.view.as_long = strtol(token, &endptr, 0);
+  /* Error position as if the symbol was parsed again */
+  if (memo->error_input >= parser->error_input) {
+    parser->error_input = memo->error_input;
+    parser->error_symbol = memo->error_symbol;
+  }
 
-  /* If not found reject parse */
-  if (token == endptr) 
+  if (memo->end == NULL)
     return (FALSE);
 
-  /* Bind value for semantic function */
-  *input = endptr;
-  value_bind(&v, output);
-
+  /* Replay the emitted code */
+  if (memo->count > 0) {
+    memcpy(*output, memo->code, memo->count * sizeof(VALUE));
+    *output = *output + memo->count;
+  }
+  *input = memo->end;
   return (TRUE);
 }
 
-int parse_float(SYMBOL *symbol, char **input, VALUE **output)
+void memo_clear(PARSER *parser)
 {
-  VALUE v;
-  char *token;
-  char *endptr;
+  MEMO *memo;
+  int i;
 
-  /* Scan for an integer value in input */
-  parse_space(symbol, input, output);
-  token = *input;
-  v.type = VALUE_LONG_TYPE;
-  v.view.as_long = strtol(token, &endptr, 0);
+  for (i = 0; i < PARSE_MEMO_SIZE; i++) {
+    while ((memo = parser->memo[i]) != NULL) {
+      parser->memo[i] = memo->next;
+      if (memo->code != NULL)
+	free(memo->code);
+      free(memo);
+    }
+  }
+  parser->memo_oldest = NULL;
+  parser->memo_newest = NULL;
+  parser->memo_low = NULL;
+  parser->memo_count = 0;
+}
 
-  /* If not found reject parse */
-  if (*endptr != '.' && *endptr != 'e') 
-    return (FALSE);
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Scanning kernels (end of space, identifier, token and string)
+ * ----------------------------------------------------------------------
+ */
 
-  /* Scan for a floating point value */
-  token = *input;
-  v.type = VALUE_DOUBLE_TYPE;
-  v.view.as_double = strtod(token, &endptr);
+#if defined(SCAN_SIMD)
 
-  /* If not found reject parse */
-  if (token == endptr) 
-    return (FALSE);
+/* Vector kernels. The loads are aligned to the vector width so that a
+   block never crosses a page boundary. The first block may start
+   before the position, and so before the start of the input buffer,
+   and the last block may extend past the end of input; these bytes
+   are read from the same page but masked off. The over-read is not
+   seen by the address sanitizer. The stop mask has one bit per byte */
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SCAN_NO_SANITIZE
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(SCAN_NO_SANITIZE)
+#define SCAN_LOAD_ATTR __attribute__((no_sanitize_address))
+#else
+#define SCAN_LOAD_ATTR
+#endif
 
-  /* Bind value for semantic function */
-  *input = endptr;
-  value_bind(&v, output);
+#define SCAN_RUN(VEC, W, LOAD, STOP, ip, end)				\
+  do {									\
+    VEC *p = (VEC *) ((unsigned long) (ip) & ~(unsigned long) ((W) - 1)); \
+    unsigned int m;							\
+    char *sp;								\
+    if ((ip) >= (end))							\
+      return (end);							\
+    m = STOP(LOAD(p)) >> ((ip) - (char *) p);				\
+    sp = (ip);								\
+    while (m == 0) {							\
+      sp = (char *) ++p;						\
+      if (sp >= (end))							\
+	return (end);							\
+      m = STOP(LOAD(p));						\
+    }									\
+    sp += __builtin_ctz(m);						\
+    return (sp < (end) ? sp : (end));					\
+  } while (0)
 
-  return (TRUE);
+#define SSE2_SET(c) _mm_set1_epi8((char) (c))
+#define SSE2_RANGE(x, lo, hi) \
+  _mm_and_si128(_mm_cmpgt_epi8(x, SSE2_SET((lo) - 1)), _mm_cmplt_epi8(x, SSE2_SET((hi) + 1)))
+#define SSE2_MASK(x) ((unsigned int) _mm_movemask_epi8(x))
+#define SSE2_LOAD(p) _mm_load_si128(p)
+
+static unsigned int sse2_space(__m128i x)
+{
+  return (SSE2_MASK(_mm_cmpgt_epi8(x, SSE2_SET(' '))));
 }
 
-int parse_string(SYMBOL *symbol, char **input, VALUE **output)
+static unsigned int sse2_identifier(__m128i x)
 {
-  VALUE v;
-  char *ip;
-  char *tp;
-  char end;
-  char c;
-  int n;
-  
-  /* Check start character */
-  parse_space(symbol, input, output);
-  ip = *input;
-  c = *ip++;
-  if (c != '"' && c != '\'')
-    return (FALSE);
+  __m128i alnum = _mm_or_si128(_mm_or_si128(SSE2_RANGE(x, 'a', 'z'), SSE2_RANGE(x, 'A', 'Z')),
+			       _mm_or_si128(SSE2_RANGE(x, '0', '9'), _mm_cmpeq_epi8(x, SSE2_SET('_'))));
+  return (~SSE2_MASK(alnum) & 0xffff);
+}
 
-  /* Scan the string. No modification! */
-  n = 0;
-  end = c;
-  tp = ip;
-  do {
-    n++;
-    if (c == '\\') {
-      c = *ip++;
-      n++;
-      if (c != 0) {
-	c = *ip++;
-	n++;
-      }
-    }
-  } while ((c = *ip++) && (c != end));
+static unsigned int sse2_token(__m128i x)
+{
+  return (~SSE2_MASK(_mm_cmpgt_epi8(x, SSE2_SET(' '))) & 0xffff);
+}
 
-  /* What out for end of string */
-  if (c == 0)
-    return (FALSE);
+#define SSE2_STRING(x) \
+  SSE2_MASK(_mm_or_si128(_mm_cmpeq_epi8(x, q), _mm_cmpeq_epi8(x, SSE2_SET('\\'))))
 
-  n--;
-  *input = ip;
+SCAN_LOAD_ATTR static char *scan_space_sse2(char *ip, char *end)
+{
+  SCAN_RUN(__m128i, 16, SSE2_LOAD, sse2_space, ip, end);
+}
 
-  /* Bind unprocessed string value for semantic function */
-  v.type = VALUE_STRING_TYPE;
-  v.view.as_string.count = n;
-  v.view.as_string.buffer = tp;
-  value_bind(&v, output);
+SCAN_LOAD_ATTR static char *scan_identifier_sse2(char *ip, char *end)
+{
+  SCAN_RUN(__m128i, 16, SSE2_LOAD, sse2_identifier, ip, end);
+}
 
-  return (TRUE);
+SCAN_LOAD_ATTR static char *scan_token_sse2(char *ip, char *end)
+{
+  SCAN_RUN(__m128i, 16, SSE2_LOAD, sse2_token, ip, end);
 }
 
-int parse_identifier(SYMBOL *symbol, char **input, VALUE **output)
+SCAN_LOAD_ATTR static char *scan_string_sse2(char *ip, char *end, int quote)
 {
-  VALUE v;
-  char *ip = *input;
-  char *tp;
-  char c;
-  int n;
-  
-  /* Check for an alpha character or underscore */
-  parse_space(symbol, input, output);
-  ip = *input;
-  c = *ip++;
-  if (!isalpha(c) && (c != '_'))
-    return (FALSE);
+  __m128i q = SSE2_SET(quote);
+  SCAN_RUN(__m128i, 16, SSE2_LOAD, SSE2_STRING, ip, end);
+}
 
-  /* Scan identifier: alpha, number or underscore sequence */
-  tp = ip - 1;
-  n = 0;
-  do {
-    n++;
-  } while ((c = *ip++) && (isalnum(c) || c == '_'));
-  *input = ip - 1;
-  
-  /* Bind value for semantic function */
-  v.type = VALUE_STRING_TYPE;
-  v.view.as_string.count = n;
-  v.view.as_string.buffer = tp;
-  value_bind(&v, output);
+/* The same classes 32 bytes at a time; selected at run-time */
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_SET(c) _mm256_set1_epi8((char) (c))
+#define AVX2_RANGE(x, lo, hi) \
+  _mm256_and_si256(_mm256_cmpgt_epi8(x, AVX2_SET((lo) - 1)), _mm256_cmpgt_epi8(AVX2_SET((hi) + 1), x))
+#define AVX2_MASK(x) ((unsigned int) _mm256_movemask_epi8(x))
+#define AVX2_LOAD(p) _mm256_load_si256(p)
 
-  return (TRUE);
+AVX2 static unsigned int avx2_space(__m256i x)
+{
+  return (AVX2_MASK(_mm256_cmpgt_epi8(x, AVX2_SET(' '))));
 }
 
-int parse_token(SYMBOL *symbol, char **input, VALUE **output)
+AVX2 static unsigned int avx2_identifier(__m256i x)
 {
-  VALUE v;
-  char *ip;
-  char *tp;
-  char c;
-  int n;
-  
-  /* Check that there was something left */
-  parse_space(symbol, input, output);
-  ip = *input;
-  c = *ip++;
-  if (c == 0)
-    return (FALSE);
+  __m256i alnum = _mm256_or_si256(_mm256_or_si256(AVX2_RANGE(x, 'a', 'z'), AVX2_RANGE(x, 'A', 'Z')),
+				  _mm256_or_si256(AVX2_RANGE(x, '0', '9'), _mm256_cmpeq_epi8(x, AVX2_SET('_'))));
+  return (~AVX2_MASK(alnum));
+}
 
-  /* Scan anything until white space */
-  tp = ip - 1;
-  n = 0;
-  do {
-    n++;
-  } while ((c = *ip++) && (c > ' '));
-  *input = ip - 1;
+AVX2 static unsigned int avx2_token(__m256i x)
+{
+  return (~AVX2_MASK(_mm256_cmpgt_epi8(x, AVX2_SET(' '))));
+}
 
-  /* Bind value for semantic function */
-  v.type = VALUE_STRING_TYPE;
-  v.view.as_string.count = n;
-  v.view.as_string.buffer = tp;
-  value_bind(&v, output);
+#define AVX2_STRING(x) \
+  AVX2_MASK(_mm256_or_si256(_mm256_cmpeq_epi8(x, q), _mm256_cmpeq_epi8(x, AVX2_SET('\\'))))
 
-  return (TRUE);
+AVX2 SCAN_LOAD_ATTR static char *scan_space_avx2(char *ip, char *end)
+{
+  SCAN_RUN(__m256i, 32, AVX2_LOAD, avx2_space, ip, end);
 }
 
-int parse_nospace(SYMBOL *symbol, char **input, VALUE **output)
+AVX2 SCAN_LOAD_ATTR static char *scan_identifier_avx2(char *ip, char *end)
 {
-  return (**input > ' ' || **input == 0);
+  SCAN_RUN(__m256i, 32, AVX2_LOAD, avx2_identifier, ip, end);
 }
 
-int parse_space(SYMBOL *symbol, char **input, VALUE **output)
+AVX2 SCAN_LOAD_ATTR static char *scan_token_avx2(char *ip, char *end)
 {
-  char *ip = *input;
-  char *tp;
-  char c;
-  
-  /* No space */
-  if (*ip > ' ' || *ip == 0)
-    return (FALSE);
-
-  /* Skip space */
-  do {
-    c = *ip++;
-  } while (c <= ' ' && c != 0);
-  *input = ip - 1;
-  
-  return (TRUE);
+  SCAN_RUN(__m256i, 32, AVX2_LOAD, avx2_token, ip, end);
 }
 
-int parse_throw(SYMBOL *symbol, char **input, VALUE **output)
+AVX2 SCAN_LOAD_ATTR static char *scan_string_avx2(char *ip, char *end, int quote)
 {
-  longjmp(parse_catch_buf, 1);
-  return (FALSE);
+  __m256i q = AVX2_SET(quote);
+  SCAN_RUN(__m256i, 32, AVX2_LOAD, AVX2_STRING, ip, end);
 }
 
-int parse_cut(SYMBOL *symbol, char **input, VALUE **output)
+#define SCAN_KERNEL(name) scan_##name##_sse2
+#else
+
+/* Scalar kernels; the byte classes of the parse primitives */
+static char *scan_space_byte(char *ip, char *end)
 {
-  parse_cutting = TRUE;
-  return (TRUE);
+  while (ip < end && *ip <= ' ')
+    ip++;
+  return (ip);
 }
 
-int parse_run(SYMBOL *symbol, char **input, VALUE **output)
+static char *scan_identifier_byte(char *ip, char *end)
 {
-  ENVIRONMENT env;
-  VALUE stack[64];
-
-  (*output)->type = VALUE_UNDEFINED_TYPE;
-  env.sp = stack;
-  env.ip = start_output;
-  parse_execute(&env);
-  *output = start_output;
-  return (!parse_executing);
+  while (ip < end && (isalnum((unsigned char) *ip) || *ip == '_'))
+    ip++;
+  return (ip);
 }
 
-int parse_pos(SYMBOL *symbol, char **input, VALUE **output)
+static char *scan_token_byte(char *ip, char *end)
 {
-  VALUE v;
-  
-  /* Bind current position for semantic function */
-  v.type = VALUE_STR_TYPE;
-  v.view.as_str = *input;
-  value_bind(&v, output);
-
-  return (TRUE);
+  while (ip < end && *ip > ' ')
+    ip++;
+  return (ip);
 }
 
-int parse_input(SYMBOL *symbol, char **input, VALUE **output)
+static char *scan_string_byte(char *ip, char *end, int quote)
 {
-  clock_t start;
-  int ok;
-  
-  /* Watch out for rookie programmers */
-  if (symbol == NULL || input == NULL || output == NULL)
+  while (ip < end && *ip != quote && *ip != '\\')
+    ip++;
+  return (ip);
+}
+
+#define SCAN_KERNEL(name) scan_##name##_byte
+#endif
+
+/* Kernel vector; SSE2 when compiled for it, AVX2 if the processor
+   supports it, otherwise byte by byte. The kernels are selected once
+   when the program is loaded and are not changed by a parse */
+typedef char *(*SCAN)(char *ip, char *end);
+typedef char *(*SCAN_QUOTE)(char *ip, char *end, int quote);
+static SCAN scan_space = SCAN_KERNEL(space);
+static SCAN scan_identifier = SCAN_KERNEL(identifier);
+static SCAN scan_token = SCAN_KERNEL(token);
+static SCAN_QUOTE scan_string = SCAN_KERNEL(string);
+
+#if defined(SCAN_SIMD)
+__attribute__((constructor)) static void scan_select(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scan_space = scan_space_avx2;
+    scan_identifier = scan_identifier_avx2;
+    scan_token = scan_token_avx2;
+    scan_string = scan_string_avx2;
+  }
+}
+#endif
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: White space (each run skipped once per parse)
+ * ----------------------------------------------------------------------
+ */
+
+#define SPACE_SLOT(ip) ((unsigned long) (ip) % PARSE_SPACE_SIZE)
+
+/* End of input and the next byte; zero at the end of input. The
+   short versions are for the bytes of a match after its start */
+#define INPUT_END(parser, ip) parse_end(parser, ip)
+#define INPUT_BYTE(parser, ip) (INPUT_END(parser, ip) ? 0 : (unsigned char) *(ip))
+#define INPUT_SHORT(parser, ip, start) parse_short(parser, ip, start)
+#define INPUT_NEXT(parser, ip, start) \
+  (INPUT_SHORT(parser, ip, start) ? 0 : (unsigned char) *(ip))
+
+static char *space_skip(PARSER *parser, char *ip)
+{
+  int slot;
+  
+  /* No space; the common case */
+  if (INPUT_END(parser, ip) || *ip > ' ')
+    return (ip);
+
+  /* Check if the run at the position was skipped before */
+  slot = SPACE_SLOT(ip);
+  if (parser->space_input[slot] == ip)
+    return (parser->space_end[slot]);
+  parser->space_input[slot] = ip;
+  ip = scan_space(ip, parser->input_end);
+  parser->space_end[slot] = ip;
+  return (ip);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Number scanning (integer and float conversion in one pass)
+ * ----------------------------------------------------------------------
+ */
+
+#define NUMBER_DIGIT(c)							\
+  ((c) >= '0' && (c) <= '9' ? (c) - '0' :				\
+   (c) >= 'a' && (c) <= 'f' ? (c) - 'a' + 10 :				\
+   (c) >= 'A' && (c) <= 'F' ? (c) - 'A' + 10 : 16)
+#define NUMBER_MANTISSA_MAX 19
+#define NUMBER_EXACT_MAX (1UL << 53)
+#define NUMBER_EXPONENT_MAX 99999
+#define NUMBER_TEXT_MAX 64
+#define NUMBER_AT(s) INPUT_NEXT(parser, s, ip)
+
+/* Powers of ten that are exact doubles */
+static const double number_exact[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* The C locale for the library conversion; created once when the
+   program is loaded and shared read only by all parses */
+#if defined(NUMBER_LOCALE)
+static locale_t number_locale = (locale_t) 0;
+
+__attribute__((constructor)) static void number_select(void)
+{
+  number_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+}
+#endif
+
+static char *number_integer(PARSER *parser, char *ip, VALUE *v, int *range)
+{
+  unsigned long limit;
+  unsigned long u;
+  char *s = ip;
+  int negative;
+  int base;
+  int d;
+
+  /* Integer as strtol with base zero; decimal, 0x hexadecimal and
+     0 octal, without locale. Out of range is reported */
+  negative = (NUMBER_AT(s) == '-');
+  if (NUMBER_AT(s) == '-' || NUMBER_AT(s) == '+')
+    s++;
+  if (NUMBER_AT(s) == '0' && (NUMBER_AT(s + 1) == 'x' || NUMBER_AT(s + 1) == 'X') &&
+      NUMBER_DIGIT(NUMBER_AT(s + 2)) < 16) {
+    base = 16;
+    s += 2;
+  }
+  else
+    base = (NUMBER_AT(s) == '0' ? 8 : 10);
+  if (NUMBER_DIGIT(NUMBER_AT(s)) >= base)
+    return (NULL);
+  limit = (negative ? -(unsigned long) LONG_MIN : (unsigned long) LONG_MAX);
+  *range = FALSE;
+  for (u = 0; (d = NUMBER_DIGIT(NUMBER_AT(s))) < base; s++) {
+    if (u > (limit - d) / base)
+      *range = TRUE;
+    u = u * base + d;
+  }
+  v->type = VALUE_LONG_TYPE;
+  v->view.as_long = (negative ? (long) -u : (long) u);
+  return (s);
+}
+
+static char *number_float(PARSER *parser, char *ip, VALUE *v, int *range)
+{
+  char text[NUMBER_TEXT_MAX];
+  unsigned long m = 0;
+  double d;
+  char *s = ip;
+  char *tp;
+  int negative;
+  int digits = 0;
+  int exact = TRUE;
+  int scale = 0;
+  int c, e, n;
+
+  /* Decimal digits with an optional fraction and exponent. The first
+     digits are collected to the mantissa and the rest scale it */
+  negative = (NUMBER_AT(s) == '-');
+  if (NUMBER_AT(s) == '-' || NUMBER_AT(s) == '+')
+    s++;
+  for (n = 0; (c = NUMBER_AT(s)) >= '0' && c <= '9'; s++, n++) {
+    if (digits < NUMBER_MANTISSA_MAX) {
+      m = m * 10 + (c - '0');
+      digits += (m != 0);
+    }
+    else {
+      exact = exact && (c == '0');
+      scale++;
+    }
+  }
+  if (c != '.' && c != 'e' && c != 'E')
+    return (NULL);
+  if (c == '.') {
+    for (s++; (c = NUMBER_AT(s)) >= '0' && c <= '9'; s++, n++) {
+      if (digits < NUMBER_MANTISSA_MAX) {
+	m = m * 10 + (c - '0');
+	digits += (m != 0);
+	scale--;
+      }
+      else
+	exact = exact && (c == '0');
+    }
+  }
+  if (n == 0)
+    return (NULL);
+  c = NUMBER_AT(s + 1);
+  if ((NUMBER_AT(s) == 'e' || NUMBER_AT(s) == 'E') &&
+      ((c >= '0' && c <= '9') ||
+       ((c == '-' || c == '+') && NUMBER_AT(s + 2) >= '0' && NUMBER_AT(s + 2) <= '9'))) {
+    s++;
+    n = (c == '-');
+    if (c == '-' || c == '+')
+      s++;
+    for (e = 0; (c = NUMBER_AT(s)) >= '0' && c <= '9'; s++)
+      if (e < NUMBER_EXPONENT_MAX)
+	e = e * 10 + (c - '0');
+    scale += (n ? -e : e);
+  }
+
+  /* Exact mantissa and power of ten give a correctly rounded result
+     with one operation; a small mantissa takes the powers above 22
+     while it stays exact. Other numbers use the library conversion in
+     the C locale on a null terminated copy */
+  if (exact && m <= NUMBER_EXACT_MAX && scale > 22 && scale <= 22 + 15 &&
+      m <= NUMBER_EXACT_MAX / (unsigned long) number_exact[scale - 22]) {
+    m *= (unsigned long) number_exact[scale - 22];
+    scale = 22;
+  }
+  if (exact && m <= NUMBER_EXACT_MAX && scale >= -22 && scale <= 22) {
+    d = (double) m;
+    d = (scale < 0 ? d / number_exact[-scale] : d * number_exact[scale]);
+    if (negative)
+      d = -d;
+  }
+  else {
+    tp = (s - ip < NUMBER_TEXT_MAX ? text : (char *) malloc(s - ip + 1));
+    if (tp == NULL)
+      return (NULL);
+    memcpy(tp, ip, s - ip);
+    tp[s - ip] = 0;
+#if defined(NUMBER_LOCALE)
+    d = (number_locale != (locale_t) 0 ?
+	 strtod_l(tp, NULL, number_locale) : strtod(tp, NULL));
+#else
+    d = strtod(tp, NULL);
+#endif
+    if (tp != text)
+      free(tp);
+  }
+  *range = (d > DBL_MAX || d < -DBL_MAX);
+  v->type = VALUE_DOUBLE_TYPE;
+  v->view.as_double = d;
+  return (s);
+}
+
+static int number_range(PARSER *parser, SYMBOL *symbol, char *ip)
+{
+  /* Capture the position for the error report */
+  if (ip >= parser->error_input) {
+    parser->error_input = ip;
+    parser->error_symbol = symbol;
+    parser->range_input = ip;
+  }
+  return (FALSE);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Keyword terminals (identifier scan and perfect hash lookup)
+ * ----------------------------------------------------------------------
+ */
+
+#define KEYWORD_CHAR(c) (isalnum(c) || (c) == '_')
+#define KEYWORD_HASH(h, c) (((h) ^ (unsigned char) (c)) * 16777619UL)
+#define KEYWORD_SLOT(t, h) ((((h) >> 16) ^ (h)) & (t)->mask)
+#define KEYWORD_TRIES 64
+
+/* Perfect hash of the keywords of a grammar; built by parse_prepare
+   for a start symbol that has keywords turned on. A slot holds the
+   keyword terminal */
+typedef struct {
+  SYMBOL *symbol;
+} KEYWORD;
+
+struct KEYWORDS {
+  int analysis;
+  KEYWORD *table;
+  unsigned long mask;
+  unsigned long seed;
+};
+
+int parse_keyword(char *name)
+{
+  /* Terminals that are identifiers may be matched as whole words */
+  if (!isalpha((unsigned char) *name) && *name != '_')
+    return (FALSE);
+  for (name++; *name != 0; name++)
+    if (!KEYWORD_CHAR((unsigned char) *name))
+      return (FALSE);
+  return (TRUE);
+}
+
+void parse_keywords(SYMBOL *symbol)
+{
+  /* The table is built by the next parse_prepare */
+  if (symbol->keywords == NULL)
+    symbol->keywords = (KEYWORDS *) calloc(1, sizeof(KEYWORDS));
+  symbol->keywords->analysis = -1;
+  parse_invalidate(symbol);
+}
+
+static unsigned long keyword_hash(unsigned long h, char *name)
+{
+  while (*name != 0)
+    h = KEYWORD_HASH(h, *name++);
+  return (h);
+}
+
+static void keyword_build(SYMBOL *start, SYMBOL **set, int count, int analysis)
+{
+  KEYWORDS *keywords = start->keywords;
+  PRODUCT *product;
+  TERM *term;
+  SYMBOL **keyword = NULL;
+  SYMBOL *symbol;
+  int n = 0;
+  int size = 0;
+  unsigned long slots;
+  int tries;
+  int i, k;
+
+  /* Collect the keyword terminals of the grammar; one per name */
+  for (i = 0; i < count; i++)
+    if (set[i]->syntax != NULL && set[i]->parse != NULL)
+      for (product = set[i]->syntax; *product != NULL; product++)
+	for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+	  symbol = term->symbol;
+	  if (term->type != TERM_TERMINAL_TYPE || !parse_keyword(symbol->name))
+	    continue;
+	  symbol->keyword = TRUE;
+	  for (k = 0; k < n; k++)
+	    if (!strcmp(keyword[k]->name, symbol->name))
+	      break;
+	  if (k < n)
+	    continue;
+	  if (n == size) {
+	    size = (size == 0 ? 64 : size * 2);
+	    keyword = (SYMBOL **) realloc(keyword, size * sizeof(SYMBOL *));
+	  }
+	  keyword[n++] = symbol;
+	}
+  keywords->analysis = analysis;
+  
+  /* Search for a seed that gives each keyword its own slot. Double
+     the table size when no seed is found */
+  for (slots = 8; slots < 2UL * n; slots *= 2);
+  keywords->seed = 2166136261UL;
+  for (tries = 0; ; tries++) {
+    if (tries == KEYWORD_TRIES) {
+      slots *= 2;
+      tries = 0;
+    }
+    keywords->seed++;
+    keywords->mask = slots - 1;
+    keywords->table = (KEYWORD *) realloc(keywords->table, slots * sizeof(KEYWORD));
+    memset(keywords->table, 0, slots * sizeof(KEYWORD));
+    for (k = 0; k < n; k++) {
+      KEYWORD *slot;
+      slot = keywords->table + KEYWORD_SLOT(keywords, keyword_hash(keywords->seed, keyword[k]->name));
+      if (slot->symbol != NULL)
+	break;
+      slot->symbol = keyword[k];
+    }
+    if (k == n)
+      break;
+  }
+  free(keyword);
+}
+
+static SYMBOL *keyword_scan(PARSER *parser, char *ip)
+{
+  KEYWORDS *keywords = parser->keywords;
+  unsigned long h = keywords->seed;
+  KEYWORD *slot;
+  SYMBOL *k;
+  char *s = ip;
+  char *np;
+  char *cp;
+
+  /* One identifier scan and hash probe per input position; the
+     alternatives at the same position compare the keyword found */
+  if (parser->keyword_input == ip)
+    return (parser->keyword);
+  while (!INPUT_SHORT(parser, s, ip) && KEYWORD_CHAR((unsigned char) *s)) {
+    h = KEYWORD_HASH(h, *s);
+    s++;
+  }
+  k = NULL;
+  if (s != ip) {
+    slot = keywords->table + KEYWORD_SLOT(keywords, h);
+    if (slot->symbol != NULL) {
+      for (np = slot->symbol->name, cp = ip; cp < s && *np == *cp; np++, cp++);
+      if (cp == s && *np == 0)
+	k = slot->symbol;
+    }
+  }
+  parser->keyword_input = ip;
+  parser->keyword_end = s;
+  parser->keyword = k;
+  return (k);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Grammar analysis (FIRST sets, nullability and product selection)
+ * ----------------------------------------------------------------------
+ */
+
+#define FIRST_ADD(set, c) ((set)[(c) >> 3] |= (1 << ((c) & 7)))
+#define FIRST_HAS(set, c) ((set)[(c) >> 3] & (1 << ((c) & 7)))
+#define SELECT_MAX ((int) (sizeof(unsigned long) * 8))
+
+/* Analysis state of a symbol. The visit mark is only set while the
+   symbols reachable from a start symbol are collected */
+#define PREPARE_DONE 1
+#define PREPARE_VISIT 2
+#define PREPARED(s) ((s)->prepared & PREPARE_DONE)
+
+/* Number of the last analysis. Symbols record the analysis that
+   built their tables; the code, keyword and lexer tables of a start
+   symbol are rebuilt when a reachable symbol is analysed again */
+static int prepare_count = 0;
+
+static int operator_symbol(SYMBOL *symbol)
+{
+  PRODUCT *product;
+  TERM *term;
+
+  /* Symbols with operator tables are only parsed by precedence
+     climbing; they are not predicted or compiled */
+  for (product = symbol->syntax; product != NULL && *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+      if (TERM_OPERATOR(term->type))
+	return (TRUE);
+  return (FALSE);
+}
+
+void parse_invalidate(SYMBOL *symbol)
+{
+  /* Symbol changed; analysed again by the next parse_prepare */
+  symbol->prepared = FALSE;
+}
+
+static int primitive_pure(PARSE parse)
+{
+  /* Primitives without side effects */
+  return (parse == parse_empty || parse == parse_eoln ||
+	  parse == parse_integer || parse == parse_float ||
+	  parse == parse_string || parse == parse_identifier ||
+	  parse == parse_token || parse == parse_nospace ||
+	  parse == parse_space || parse == parse_pos || parse == parse_cut ||
+	  parse == parse_regex || parse == parse_dfa);
+}
+
+static void first_primitive(SYMBOL *symbol)
+{
+  PARSE parse = symbol->parse;
+  int c;
+  
+  /* Primitive parse functions are classified by their first byte */
+  symbol->pure = primitive_pure(parse);
+  if (parse == parse_empty || parse == parse_nospace || parse == parse_pos) {
+    symbol->nullable = TRUE;
+  }
+  else if (parse == parse_eoln) {
+    FIRST_ADD(symbol->first, 0);
+  }
+  else if (parse == parse_integer || parse == parse_float) {
+    for (c = '0'; c <= '9'; c++)
+      FIRST_ADD(symbol->first, c);
+    FIRST_ADD(symbol->first, '+');
+    FIRST_ADD(symbol->first, '-');
+    if (parse == parse_float)
+      FIRST_ADD(symbol->first, '.');
+  }
+  else if (parse == parse_string) {
+    FIRST_ADD(symbol->first, '"');
+    FIRST_ADD(symbol->first, '\'');
+  }
+  else if (parse == parse_identifier) {
+    for (c = 1; c < 128; c++)
+      if (isalpha(c) || c == '_')
+	FIRST_ADD(symbol->first, c);
+  }
+  else if (parse == parse_regex) {
+    FIRST_ADD(symbol->first, '/');
+  }
+  else if (parse == parse_dfa) {
+    for (c = 1; c < 256; c++)
+      if (symbol->dfa->next[symbol->dfa->map[c]] >= 0)
+	FIRST_ADD(symbol->first, c);
+    symbol->nullable = symbol->dfa->accept[0];
+  }
+  else if (parse == parse_token) {
+    memset(symbol->first, 0xff, PARSE_FIRST_SIZE);
+    symbol->first[0] &= ~1;
+  }
+  else {
+    /* Space, cut, execute, error and unknown functions are always tried */
+    memset(symbol->first, 0xff, PARSE_FIRST_SIZE);
+  }
+}
+
+static void first_visit(SYMBOL *symbol, SYMBOL ***set, int *count, int *size)
+{
+  PRODUCT *product;
+  TERM *term;
+
+  /* Collect the symbol, primitives included, and visit the symbols of
+     the products */
+  if (symbol->prepared & PREPARE_VISIT)
+    return;
+  symbol->prepared |= PREPARE_VISIT;
+  if (*count == *size) {
+    *size = (*size == 0 ? 64 : *size * 2);
+    *set = (SYMBOL **) realloc(*set, *size * sizeof(SYMBOL *));
+  }
+  (*set)[(*count)++] = symbol;
+  if (symbol->syntax == NULL || symbol->parse == NULL)
+    return;
+  for (product = symbol->syntax; *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+      if (term->type != TERM_TERMINAL_TYPE)
+	first_visit(term->symbol, set, count, size);
+}
+
+static int first_product(PRODUCT product, unsigned char *first)
+{
+  TERM *term;
+  int i;
+  
+  /* Union of the leading terms up to the first that is not nullable;
+     lookahead does not consume input */
+  for (term = product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+    if (TERM_PREDICATE(term->type))
+      continue;
+    if (term->type == TERM_TERMINAL_TYPE) {
+      if (*term->symbol->name == 0)
+	memset(first, 0xff, PARSE_FIRST_SIZE);
+      else
+	FIRST_ADD(first, (unsigned char) *term->symbol->name);
+      return (FALSE);
+    }
+    for (i = 0; i < PARSE_FIRST_SIZE; i++)
+      first[i] |= term->symbol->first[i];
+    if (term->type != TERM_ZERO_OR_ONE_TYPE &&
+	term->type != TERM_ZERO_OR_MANY_TYPE &&
+	!TERM_OPERATOR(term->type) &&
+	!term->symbol->nullable)
+      return (FALSE);
+  }
+  return (TRUE);
+}
+
+static int first_follow(SYMBOL *symbol, TERM *term, unsigned char *first)
+{
+  int i;
+  
+  /* FIRST of the rest of the product, and FOLLOW if it is nullable */
+  memset(first, 0, PARSE_FIRST_SIZE);
+  if (first_product(term, first))
+    for (i = 0; i < PARSE_FIRST_SIZE; i++)
+      first[i] |= symbol->follow[i];
+  for (i = 0; i < 256; i++)
+    if (FIRST_HAS(first, i))
+      return (i + 1);
+  return (0);
+}
+
+/* Byte trie of the leading terminals of the products of a symbol */
+typedef struct {
+  int byte;
+  int child;
+  int sibling;
+  unsigned long match;
+} TRIE_NODE;
+
+struct TRIE {
+  TRIE_NODE *node;
+  int count;
+  int size;
+  unsigned long terminals;
+  int *order;
+};
+
+#define TRIE_ACTIVE(s) \
+  ((s)->trie != NULL && (s)->trie->count > 0 && PREPARED(s))
+#define PRODUCT_ORDER(s, i) (TRIE_ACTIVE(s) ? (s)->trie->order[i] : (i))
+
+static int trie_node(TRIE *trie, int byte)
+{
+  TRIE_NODE *node;
+
+  if (trie->count == trie->size) {
+    trie->size = (trie->size == 0 ? 16 : trie->size * 2);
+    trie->node = (TRIE_NODE *) realloc(trie->node, trie->size * sizeof(TRIE_NODE));
+  }
+  node = &trie->node[trie->count];
+  node->byte = byte;
+  node->child = -1;
+  node->sibling = -1;
+  node->match = 0;
+  return (trie->count++);
+}
+
+static int trie_extends(PRODUCT x, PRODUCT y)
+{
+  /* Leading terminal of x is longer and starts with that of y */
+  int n = strlen(y->symbol->name);
+  return (x->type == TERM_TERMINAL_TYPE &&
+	  (int) strlen(x->symbol->name) > n &&
+	  !strncmp(x->symbol->name, y->symbol->name, n));
+}
+
+static void trie_build(SYMBOL *symbol)
+{
+  TRIE *trie = symbol->trie;
+  PRODUCT *syntax = symbol->syntax;
+  char *done;
+  char *np;
+  int products, leading;
+  int i, j, k, m, n;
+
+  /* Symbols with two or more products starting with a terminal */
+  for (products = leading = 0; syntax[products] != NULL; products++)
+    if (syntax[products]->type == TERM_TERMINAL_TYPE)
+      leading++;
+  if (leading < 2) {
+    if (trie != NULL)
+      trie->count = 0;
+    return;
+  }
+  if (trie == NULL)
+    trie = symbol->trie = (TRIE *) calloc(1, sizeof(TRIE));
+
+  /* Insert the leading terminals; the node at the end of a terminal
+     marks the products that start with it */
+  trie->count = 0;
+  trie->terminals = 0;
+  trie_node(trie, 0);
+  for (i = 0; i < products && i < SELECT_MAX; i++) {
+    if (syntax[i]->type != TERM_TERMINAL_TYPE)
+      continue;
+    trie->terminals |= (1UL << i);
+    for (n = 0, np = syntax[i]->symbol->name; *np != 0; np++) {
+      for (k = trie->node[n].child; k >= 0; k = trie->node[k].sibling)
+	if (trie->node[k].byte == (unsigned char) *np)
+	  break;
+      if (k < 0) {
+	k = trie_node(trie, (unsigned char) *np);
+	trie->node[k].sibling = trie->node[n].child;
+	trie->node[n].child = k;
+      }
+      n = k;
+    }
+    trie->node[n].match |= (1UL << i);
+  }
+
+  /* Products are tried in order except that a product is preceded by
+     the later products with a longer leading terminal starting with
+     its own; longest first. Only these may match the same input */
+  trie->order = (int *) realloc(trie->order, products * sizeof(int));
+  done = (char *) calloc(products, 1);
+  for (m = 0, i = 0; i < products; i++) {
+    if (done[i])
+      continue;
+    if (syntax[i]->type == TERM_TERMINAL_TYPE) {
+      for (;;) {
+	for (k = -1, j = i + 1; j < products; j++)
+	  if (!done[j] && trie_extends(syntax[j], syntax[i]) &&
+	      (k < 0 || strlen(syntax[j]->symbol->name) > strlen(syntax[k]->symbol->name)))
+	    k = j;
+	if (k < 0)
+	  break;
+	trie->order[m++] = k;
+	done[k] = TRUE;
+      }
+    }
+    trie->order[m++] = i;
+    done[i] = TRUE;
+  }
+  free(done);
+}
+
+static unsigned long trie_select(PARSER *parser, TRIE *trie, char *ip)
+{
+  unsigned long match = 0;
+  char *start = ip;
+  int n = 0;
+  int k;
+
+  /* One pass over the input gives all leading terminals that match */
+  while (!INPUT_SHORT(parser, ip, start)) {
+    for (k = trie->node[n].child; k >= 0; k = trie->node[k].sibling)
+      if (trie->node[k].byte == (unsigned char) *ip)
+	break;
+    if (k < 0)
+      break;
+    match |= trie->node[k].match;
+    n = k;
+    ip++;
+  }
+  return (~trie->terminals | match);
+}
+
+int parse_order(SYMBOL *symbol, int n)
+{
+  return (PRODUCT_ORDER(symbol, n));
+}
+
+#define COMMIT_ACTIVE(s) ((s)->commit != NULL && PREPARED(s))
+#define PRODUCT_COMMIT(s, i) (COMMIT_ACTIVE(s) ? (s)->commit[i] : 0)
+
+static int commit_term(TERM *term, unsigned char *first)
+{
+  /* A term that consumes input; FIRST of the term alone */
+  memset(first, 0, PARSE_FIRST_SIZE);
+  if (term->type == TERM_TERMINAL_TYPE) {
+    if (*term->symbol->name == 0)
+      return (FALSE);
+    FIRST_ADD(first, (unsigned char) *term->symbol->name);
+    return (TRUE);
+  }
+  if ((term->type != TERM_NON_TERMINAL_TYPE && term->type != TERM_ONE_OR_MANY_TYPE) ||
+      term->symbol->nullable || FIRST_HAS(term->symbol->first, 0))
+    return (FALSE);
+  memcpy(first, term->symbol->first, PARSE_FIRST_SIZE);
+  return (TRUE);
+}
+
+static int commit_after(PRODUCT x, PRODUCT y)
+{
+  unsigned char first[PARSE_FIRST_SIZE];
+  unsigned char rest[PARSE_FIRST_SIZE];
+  int m, i;
+
+  /* Terms of x needed before y cannot match the same input; y has the
+     same leading terms and then cannot start where x continued */
+  for (m = 0; x[m].type != TERM_PRODUCT_END_TYPE; m++) {
+    if (commit_term(&x[m], first)) {
+      memset(rest, 0, PARSE_FIRST_SIZE);
+      if (!first_product(&y[m], rest)) {
+	for (i = 0; i < PARSE_FIRST_SIZE; i++)
+	  if (first[i] & rest[i])
+	    break;
+	if (i == PARSE_FIRST_SIZE)
+	  return (m + 1);
+      }
+    }
+    if (y[m].type == TERM_PRODUCT_END_TYPE ||
+	x[m].type != y[m].type || x[m].symbol != y[m].symbol)
+      return (0);
+  }
+  return (0);
+}
+
+static void commit_build(SYMBOL *symbol)
+{
+  PRODUCT *syntax = symbol->syntax;
+  int i, j, k, m, n, after;
+
+  /* Back-tracking symbols; commit when the later products cannot match */
+  for (n = 0; syntax[n] != NULL; n++);
+  if ((symbol->parse != parse_syntax && symbol->parse != parse_memo) || n < 2) {
+    free(symbol->commit);
+    symbol->commit = NULL;
+    return;
+  }
+  symbol->commit = (unsigned char *) realloc(symbol->commit, n);
+  for (i = 0; i < n; i++) {
+    k = PRODUCT_ORDER(symbol, i);
+    for (m = 0, j = i + 1; j < n; j++) {
+      after = commit_after(syntax[k], syntax[PRODUCT_ORDER(symbol, j)]);
+      if (after == 0 || after > 255)
+	break;
+      if (after > m)
+	m = after;
+    }
+    symbol->commit[k] = (j == n ? m : 0);
+  }
+}
+
+int parse_commit(SYMBOL *symbol, int n)
+{
+  return (PRODUCT_COMMIT(symbol, n));
+}
+
+static void lalr_prepare(SYMBOL *symbol);
+static void vm_prepare(SYMBOL *symbol, int analysis);
+static void vm_free(VM *vm);
+static void lexer_prepare(SYMBOL *symbol, int analysis);
+
+static void predict_build(SYMBOL *symbol)
+{
+  unsigned char follow[PARSE_FIRST_SIZE];
+  unsigned char *first;
+  PRODUCT *product;
+  TERM *term;
+  int n, j, c;
+
+  /* Product FIRST sets; nullable products also select on FOLLOW */
+  for (n = 0; symbol->syntax[n] != NULL; n++);
+  first = (unsigned char *) calloc(n, PARSE_FIRST_SIZE);
+  symbol->conflict = 0;
+  for (j = 0; j < n; j++)
+    first_follow(symbol, symbol->syntax[j], first + j * PARSE_FIRST_SIZE);
+
+  /* LL(1) if no two products select on the same byte */
+  for (c = 0; c < 256 && symbol->conflict == 0; c++) {
+    int k = 0;
+    for (j = 0; j < n; j++)
+      if (FIRST_HAS(first + j * PARSE_FIRST_SIZE, c))
+	k++;
+    if (k > 1)
+      symbol->conflict = c + 1;
+  }
+
+  /* and no repetition that may continue on a byte that follows it */
+  for (product = symbol->syntax; *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+      if (symbol->conflict != 0)
+	break;
+      if (term->type != TERM_ZERO_OR_ONE_TYPE &&
+	  term->type != TERM_ZERO_OR_MANY_TYPE &&
+	  term->type != TERM_ONE_OR_MANY_TYPE)
+	continue;
+      c = first_follow(symbol, term + 1, follow);
+      if (term->symbol->nullable) {
+	symbol->conflict = (c == 0 ? 1 : c);
+	break;
+      }
+      for (c = 0; c < 256; c++)
+	if (FIRST_HAS(term->symbol->first, c) && FIRST_HAS(follow, c)) {
+	  symbol->conflict = c + 1;
+	  break;
+	}
+    }
+  free(first);
+
+  /* Prediction table; the first product that the back-tracking parser
+     would try and that might succeed */
+  if (symbol->predict == NULL)
+    symbol->predict = (unsigned char *) malloc(256);
+  memset(symbol->predict, 0, 256);
+  for (j = (n < 256 ? n : 255) - 1; j >= 0; j--) {
+    memset(follow, 0, PARSE_FIRST_SIZE);
+    if (first_product(symbol->syntax[j], follow))
+      memset(follow, 0xff, PARSE_FIRST_SIZE);
+    for (c = 0; c < 256; c++)
+      if (FIRST_HAS(follow, c))
+	symbol->predict[c] = j + 1;
+  }
+
+  /* Select predictive parser for LL(1) symbols without side effects.
+     Symbols with lookahead predicates are not pure and not predicted */
+  if (symbol->parse == parse_syntax || symbol->parse == parse_predict) {
+    if (symbol->conflict == 0 && symbol->pure && n < 256 &&
+	!operator_symbol(symbol))
+      symbol->parse = parse_predict;
+    else
+      symbol->parse = parse_syntax;
+  }
+}
+
+static void grammar_prepare(SYMBOL *start, SYMBOL **set, int count, int analysis)
+{
+  PRODUCT *product;
+  TERM *term;
+  int i;
+
+  /* Compile the start symbol and the symbols looked ahead for, and
+     build the keyword and lexer tables, if older than the analysis */
+  vm_prepare(start, analysis);
+  for (i = 0; i < count; i++)
+    if (set[i]->syntax != NULL && set[i]->parse != NULL)
+      for (product = set[i]->syntax; *product != NULL; product++)
+	for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+	  if (TERM_PREDICATE(term->type))
+	    vm_prepare(term->symbol, analysis);
+  if (start->keywords != NULL && start->keywords->analysis < analysis)
+    keyword_build(start, set, count, analysis);
+  lexer_prepare(start, analysis);
+}
+
+void parse_prepare(SYMBOL *symbol)
+{
+  unsigned char first[PARSE_FIRST_SIZE];
+  SYMBOL *start = symbol;
+  SYMBOL **set = NULL;
+  PRODUCT *product;
+  TERM *term;
+  int changed;
+  int count = 0;
+  int size = 0;
+  int i, j, c;
+
+  /* Collect the reachable symbols. The analysis is up to date if they
+     are all prepared and anything may follow the start symbol */
+  first_visit(symbol, &set, &count, &size);
+  for (changed = FALSE, i = 0; i < count; i++) {
+    set[i]->prepared &= ~PREPARE_VISIT;
+    if (!PREPARED(set[i]))
+      changed = TRUE;
+  }
+  for (i = 0; i < PARSE_FIRST_SIZE && !changed; i++)
+    if (symbol->syntax != NULL && symbol->follow[i] != 0xff)
+      changed = TRUE;
+  if (!changed) {
+    for (i = 0, j = 0; i < count; i++)
+      if (set[i]->analysis > j)
+	j = set[i]->analysis;
+    grammar_prepare(start, set, count, j);
+    free(set);
+    return;
+  }
+  prepare_count++;
+
+  /* Primitives are classified by their parse function. The FOLLOW sets
+     of prepared symbols are kept; they may also be used from another
+     start symbol. The others are analysed from the start */
+  for (i = 0, j = 0; i < count; i++) {
+    symbol = set[i];
+    memset(symbol->first, 0, PARSE_FIRST_SIZE);
+    symbol->nullable = FALSE;
+    if (symbol->syntax == NULL || symbol->parse == NULL) {
+      first_primitive(symbol);
+      symbol->prepared = PREPARE_DONE;
+      continue;
+    }
+    if (!PREPARED(symbol))
+      memset(symbol->follow, 0, PARSE_FIRST_SIZE);
+    symbol->pure = TRUE;
+    set[j++] = symbol;
+  }
+  count = j;
+
+  /* Iterate FIRST sets and nullability until a fix point is reached */
+  do {
+    changed = FALSE;
+    for (i = 0; i < count; i++) {
+      symbol = set[i];
+      memcpy(first, symbol->first, PARSE_FIRST_SIZE);
+      for (product = symbol->syntax; *product != NULL; product++)
+	if (first_product(*product, symbol->first) && !symbol->nullable) {
+	  symbol->nullable = TRUE;
+	  changed = TRUE;
+	}
+      if (memcmp(first, symbol->first, PARSE_FIRST_SIZE))
+	changed = TRUE;
+    }
+  } while (changed);
+
+  /* Anything may follow the start symbol. Iterate FOLLOW sets and
+     side effects (execute, error, lookahead, etc) */
+  if (count > 0 && set[0] == start)
+    memset(start->follow, 0xff, PARSE_FIRST_SIZE);
+  do {
+    changed = FALSE;
+    for (i = 0; i < count; i++) {
+      symbol = set[i];
+      for (product = symbol->syntax; *product != NULL; product++)
+	for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+	  if (term->type == TERM_TERMINAL_TYPE)
+	    continue;
+	  first_follow(symbol, term + 1, first);
+	  if (term->type == TERM_ZERO_OR_MANY_TYPE ||
+	      term->type == TERM_ONE_OR_MANY_TYPE ||
+	      TERM_OPERATOR(term->type))
+	    for (j = 0; j < PARSE_FIRST_SIZE; j++)
+	      first[j] |= term->symbol->first[j];
+	  for (j = 0; j < PARSE_FIRST_SIZE; j++)
+	    if (first[j] & ~term->symbol->follow[j]) {
+	      term->symbol->follow[j] |= first[j];
+	      changed = TRUE;
+	    }
+	  if (symbol->pure &&
+	      (!term->symbol->pure || TERM_PREDICATE(term->type))) {
+	    symbol->pure = FALSE;
+	    changed = TRUE;
+	  }
+	}
+    }
+  } while (changed);
+
+  /* Build the first byte to product selection and prediction tables,
+     and the LALR(1) tables of the changed yacc symbols */
+  for (i = 0; i < count; i++) {
+    symbol = set[i];
+    if (symbol->parse == parse_lalr && !PREPARED(symbol))
+      lalr_prepare(symbol);
+    symbol->prepared = PREPARE_DONE;
+    if (symbol->select == NULL)
+      symbol->select = (unsigned long *) malloc(256 * sizeof(unsigned long));
+    memset(symbol->select, 0, 256 * sizeof(unsigned long));
+    for (j = 0, product = symbol->syntax; *product != NULL; j++, product++) {
+      if (j == SELECT_MAX)
+	break;
+      memset(first, 0, PARSE_FIRST_SIZE);
+      if (first_product(*product, first))
+	memset(first, 0xff, PARSE_FIRST_SIZE);
+      for (c = 0; c < 256; c++)
+	if (FIRST_HAS(first, c))
+	  symbol->select[c] |= (1UL << j);
+    }
+    predict_build(symbol);
+    trie_build(symbol);
+    commit_build(symbol);
+    symbol->analysis = prepare_count;
+  }
+  grammar_prepare(start, set, count, prepare_count);
+  free(set);
+}
+
+static void select_reject(PARSER *parser, PRODUCT product, char *input)
+{
+  TERM *term;
+  
+  /* Capture error as if the first term that must match had failed */
+  if (input < parser->error_input)
+    return;
+  for (term = product; term->type != TERM_PRODUCT_END_TYPE; term++)
+    if (term->type == TERM_TERMINAL_TYPE ||
+	term->type == TERM_NON_TERMINAL_TYPE ||
+	term->type == TERM_ONE_OR_MANY_TYPE)
+      if (term->type == TERM_TERMINAL_TYPE || !term->symbol->nullable) {
+	parser->error_input = input;
+	parser->error_symbol = TERM_ERROR(term);
+	return;
+      }
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Regular expression terminals (Thompson NFA to DFA)
+ * ----------------------------------------------------------------------
+ */
+
+#define REGEX_SET_SIZE (256 / 8)
+#define REGEX_STATES_MAX 4096
+
+typedef struct NFA NFA;
+typedef struct REGEX REGEX;
+
+/* NFA node; byte transition to next when the set is not empty,
+   otherwise epsilon transitions to next and alt (-1 for none) */
+struct NFA {
+  unsigned char set[REGEX_SET_SIZE];
+  int empty;
+  int next;
+  int alt;
+};
+
+struct REGEX {
+  char *pp;
+  char *end;
+  NFA *node;
+  int count;
+  int size;
+  int error;
+};
+
+static int regex_node(REGEX *re)
+{
+  NFA *node;
+
+  if (re->count == re->size) {
+    re->size = (re->size == 0 ? 64 : re->size * 2);
+    re->node = (NFA *) realloc(re->node, re->size * sizeof(NFA));
+  }
+  node = &re->node[re->count];
+  memset(node->set, 0, REGEX_SET_SIZE);
+  node->empty = TRUE;
+  node->next = -1;
+  node->alt = -1;
+  return (re->count++);
+}
+
+static int regex_escape(REGEX *re, unsigned char *set)
+{
+  int c;
+
+  /* Escaped character or class (\d, \w, \s); returns the character */
+  if (re->pp == re->end) {
+    re->error = TRUE;
+    return (0);
+  }
+  c = (unsigned char) *re->pp++;
+  switch (c) {
+  case 'd':
+  case 'w':
+  case 's':
+    for (c = 1; c < 256; c++)
+      if ((re->pp[-1] == 'd' && isdigit(c)) ||
+	  (re->pp[-1] == 'w' && (isalnum(c) || c == '_')) ||
+	  (re->pp[-1] == 's' && isspace(c)))
+	FIRST_ADD(set, c);
+    return (-1);
+  case 'n': c = '\n'; break;
+  case 't': c = '\t'; break;
+  case 'r': c = '\r'; break;
+  }
+  FIRST_ADD(set, c);
+  return (c);
+}
+
+static void regex_class(REGEX *re, unsigned char *set)
+{
+  unsigned char range[REGEX_SET_SIZE];
+  int negate = FALSE;
+  int from, to;
+  int i;
+
+  /* Character class with ranges; [^...] is the complement */
+  memset(range, 0, REGEX_SET_SIZE);
+  if (re->pp < re->end && *re->pp == '^') {
+    negate = TRUE;
+    re->pp++;
+  }
+  do {
+    if (re->pp == re->end) {
+      re->error = TRUE;
+      return;
+    }
+    if (*re->pp == '\\') {
+      re->pp++;
+      from = regex_escape(re, range);
+    }
+    else {
+      from = (unsigned char) *re->pp++;
+      FIRST_ADD(range, from);
+    }
+    if (from > 0 && re->pp + 1 < re->end && re->pp[0] == '-' && re->pp[1] != ']') {
+      re->pp++;
+      to = (unsigned char) *re->pp++;
+      if (to == '\\' && re->pp < re->end)
+	to = (unsigned char) *re->pp++;
+      for (; from <= to; from++)
+	FIRST_ADD(range, from);
+    }
+  } while (re->pp < re->end && *re->pp != ']');
+  if (re->pp == re->end) {
+    re->error = TRUE;
+    return;
+  }
+  re->pp++;
+  for (i = 0; i < REGEX_SET_SIZE; i++)
+    set[i] = (negate ? ~range[i] : range[i]);
+  set[0] &= ~1;
+}
+
+static void regex_alternative(REGEX *re, int *start, int *end);
+
+static void regex_atom(REGEX *re, int *start, int *end)
+{
+  unsigned char set[REGEX_SET_SIZE];
+  int c;
+
+  /* Group, class, any byte, escape or plain character */
+  memset(set, 0, REGEX_SET_SIZE);
+  c = (unsigned char) *re->pp++;
+  if (c == '(') {
+    regex_alternative(re, start, end);
+    if (re->pp == re->end || *re->pp != ')')
+      re->error = TRUE;
+    else
+      re->pp++;
+    return;
+  }
+  if (c == '[')
+    regex_class(re, set);
+  else if (c == '.') {
+    memset(set, 0xff, REGEX_SET_SIZE);
+    set[0] &= ~1;
+  }
+  else if (c == '\\')
+    regex_escape(re, set);
+  else if (c == ')' || c == '*' || c == '+' || c == '?')
+    re->error = TRUE;
+  else
+    FIRST_ADD(set, c);
+  *start = regex_node(re);
+  *end = regex_node(re);
+  memcpy(re->node[*start].set, set, REGEX_SET_SIZE);
+  re->node[*start].empty = FALSE;
+  re->node[*start].next = *end;
+}
+
+static void regex_sequence(REGEX *re, int *start, int *end)
+{
+  int s, e, n, m;
+
+  /* Concatenation of atoms with postfix operators */
+  *start = *end = regex_node(re);
+  while (re->pp < re->end && *re->pp != '|' && *re->pp != ')' && !re->error) {
+    regex_atom(re, &s, &e);
+    while (re->pp < re->end && !re->error &&
+	   (*re->pp == '*' || *re->pp == '+' || *re->pp == '?')) {
+      n = regex_node(re);
+      switch (*re->pp++) {
+      case '*':
+	m = regex_node(re);
+	re->node[n].next = s;
+	re->node[n].alt = m;
+	re->node[e].next = s;
+	re->node[e].alt = m;
+	s = n;
+	e = m;
+	break;
+      case '+':
+	re->node[e].next = s;
+	re->node[e].alt = n;
+	e = n;
+	break;
+      case '?':
+	re->node[n].next = s;
+	re->node[n].alt = e;
+	s = n;
+	break;
+      }
+    }
+    re->node[*end].next = s;
+    *end = e;
+  }
+}
+
+static void regex_alternative(REGEX *re, int *start, int *end)
+{
+  int s, e, n;
+
+  /* Alternatives share a new start and end node */
+  regex_sequence(re, start, end);
+  while (re->pp < re->end && *re->pp == '|' && !re->error) {
+    re->pp++;
+    regex_sequence(re, &s, &e);
+    n = regex_node(re);
+    re->node[n].next = *start;
+    re->node[n].alt = s;
+    *start = n;
+    n = regex_node(re);
+    re->node[*end].next = n;
+    re->node[e].next = n;
+    *end = n;
+  }
+}
+
+static void regex_closure(REGEX *re, unsigned char *set, int *stack)
+{
+  int sp = 0;
+  int n;
+
+  /* Add the nodes reachable by epsilon transitions */
+  for (n = 0; n < re->count; n++)
+    if (FIRST_HAS(set, n))
+      stack[sp++] = n;
+  while (sp > 0) {
+    NFA *node = &re->node[stack[--sp]];
+    if (!node->empty)
+      continue;
+    if (node->next >= 0 && !FIRST_HAS(set, node->next)) {
+      FIRST_ADD(set, node->next);
+      stack[sp++] = node->next;
+    }
+    if (node->alt >= 0 && !FIRST_HAS(set, node->alt)) {
+      FIRST_ADD(set, node->alt);
+      stack[sp++] = node->alt;
+    }
+  }
+}
+
+static DFA *regex_dfa(REGEX *re, int start, int *end, int ends, short **label)
+{
+  DFA *dfa = NULL;
+  unsigned char *sets;
+  unsigned char *set;
+  short *next;
+  int *stack;
+  int map[256];
+  int full = FALSE;
+  int width, states, classes;
+  int s, c, d, n;
+
+  /* Bytes are in the same class when all nodes treat them the same */
+  for (classes = 0, c = 1; c < 256; c++) {
+    for (d = 1; d < c; d++) {
+      for (n = 0; n < re->count; n++)
+	if (!FIRST_HAS(re->node[n].set, c) != !FIRST_HAS(re->node[n].set, d))
+	  break;
+      if (n == re->count)
+	break;
+    }
+    map[c] = (d < c ? map[d] : classes++);
+  }
+  map[0] = classes++;
+
+  /* Subset construction; each DFA state is a set of NFA nodes */
+  width = (re->count + 7) / 8;
+  stack = (int *) malloc(re->count * sizeof(int));
+  sets = (unsigned char *) calloc(REGEX_STATES_MAX + 1, width);
+  next = (short *) malloc(REGEX_STATES_MAX * classes * sizeof(short));
+  FIRST_ADD(sets, start);
+  regex_closure(re, sets, stack);
+  for (states = 1, s = 0; s < states && !full; s++) {
+    for (d = 0; d < classes; d++) {
+      next[s * classes + d] = -1;
+      for (c = 1; c < 256 && map[c] != d; c++);
+      if (c == 256)
+	continue;
+      set = sets + states * width;
+      memset(set, 0, width);
+      for (n = 0; n < re->count; n++)
+	if (FIRST_HAS(sets + s * width, n) && !re->node[n].empty &&
+	    FIRST_HAS(re->node[n].set, c))
+	  FIRST_ADD(set, re->node[n].next);
+      for (n = 0; n < width && set[n] == 0; n++);
+      if (n == width)
+	continue;
+      regex_closure(re, set, stack);
+      for (n = 0; n < states && memcmp(sets + n * width, set, width); n++);
+      if (n == states) {
+	if (states == REGEX_STATES_MAX) {
+	  full = TRUE;
+	  break;
+	}
+	states++;
+      }
+      next[s * classes + d] = n;
+    }
+  }
+
+  /* Build the transition table unless the state limit was reached.
+     The label of a state is the first end node it contains */
+  if (!full) {
+    dfa = (DFA *) malloc(sizeof(DFA));
+    dfa->states = states;
+    dfa->classes = classes;
+    dfa->map = (unsigned char *) malloc(256);
+    for (c = 0; c < 256; c++)
+      dfa->map[c] = map[c];
+    dfa->next = (short *) realloc(next, states * classes * sizeof(short));
+    dfa->accept = (unsigned char *) malloc(states);
+    if (label != NULL)
+      *label = (short *) malloc(states * sizeof(short));
+    for (s = 0; s < states; s++) {
+      for (n = 0; n < ends && !FIRST_HAS(sets + s * width, end[n]); n++);
+      dfa->accept[s] = (n < ends);
+      if (label != NULL)
+	(*label)[s] = (n < ends ? n + 1 : 0);
+    }
+    next = NULL;
+  }
+  free(next);
+  free(sets);
+  free(stack);
+  return (dfa);
+}
+
+DFA *parse_regex_compile(char *pattern, int length)
+{
+  REGEX re;
+  DFA *dfa = NULL;
+  int start, end;
+
+  /* Parse the pattern to an NFA and convert it */
+  memset(&re, 0, sizeof(re));
+  re.pp = pattern;
+  re.end = pattern + length;
+  if (length > 0)
+    regex_alternative(&re, &start, &end);
+  if (length > 0 && !re.error && re.pp == re.end)
+    dfa = regex_dfa(&re, start, &end, 1, NULL);
+  free(re.node);
+  return (dfa);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Lexer stage (tokens of each input position scanned once)
+ * ----------------------------------------------------------------------
+ */
+
+#define LEXER_INTEGER 1
+#define LEXER_FLOAT 2
+#define LEXER_STRING 4
+#define LEXER_IDENTIFIER 8
+
+struct LEXER {
+  int analysis;
+  int ok;
+  int primitives;
+  DFA *dfa;
+  short *label;
+  SYMBOL **symbol;
+  int terminals;
+  int count;
+  int size;
+};
+
+struct TOKEN {
+  SYMBOL *symbol;
+  char *end;
+  VALUE value;
+};
+
+void parse_lexer(SYMBOL *symbol)
+{
+  /* Tables are generated by the next parse_prepare */
+  if (symbol->lexer == NULL)
+    symbol->lexer = (LEXER *) calloc(1, sizeof(LEXER));
+  symbol->lexer->analysis = -1;
+  parse_invalidate(symbol);
+}
+
+static void lexer_add(LEXER *lexer, SYMBOL *symbol)
+{
+  int i;
+
+  for (i = 0; i < lexer->count; i++)
+    if (lexer->symbol[i] == symbol)
+      return;
+  if (lexer->count == lexer->size) {
+    lexer->size = (lexer->size == 0 ? 64 : lexer->size * 2);
+    lexer->symbol = (SYMBOL **) realloc(lexer->symbol, lexer->size * sizeof(SYMBOL *));
+  }
+  lexer->symbol[lexer->count++] = symbol;
+}
+
+static void lexer_visit(LEXER *lexer, SYMBOL *symbol, SYMBOL ***set, int *count, int *size)
+{
+  PRODUCT *product;
+  TERM *term;
+  int i;
+
+  /* Collect the primitives and the terminals of the reachable products */
+  for (i = 0; i < *count; i++)
+    if ((*set)[i] == symbol)
+      return;
+  if (*count == *size) {
+    *size = (*size == 0 ? 64 : *size * 2);
+    *set = (SYMBOL **) realloc(*set, *size * sizeof(SYMBOL *));
+  }
+  (*set)[(*count)++] = symbol;
+  if (symbol->syntax == NULL) {
+    if (symbol->parse == parse_integer)
+      lexer->primitives |= LEXER_INTEGER;
+    else if (symbol->parse == parse_float)
+      lexer->primitives |= LEXER_FLOAT;
+    else if (symbol->parse == parse_string)
+      lexer->primitives |= LEXER_STRING;
+    else if (symbol->parse == parse_identifier)
+      lexer->primitives |= LEXER_IDENTIFIER;
+    return;
+  }
+  for (product = symbol->syntax; *product != NULL; product++)
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++)
+      if (term->type == TERM_TERMINAL_TYPE)
+	lexer_add(lexer, term->symbol);
+      else
+	lexer_visit(lexer, term->symbol, set, count, size);
+}
+
+static void lexer_prepare(SYMBOL *symbol, int analysis)
+{
+  LEXER *lexer = symbol->lexer;
+  SYMBOL **set = NULL;
+  REGEX re;
+  int *end;
+  int count = 0;
+  int size = 0;
+  int i, n, s;
+  char *np;
+
+  /* Tables of the terminals reachable from the symbol */
+  if (lexer == NULL || lexer->analysis >= analysis)
+    return;
+  lexer->analysis = analysis;
+  lexer->primitives = 0;
+  lexer->count = 0;
+  free(lexer->label);
+  lexer->label = NULL;
+  if (lexer->dfa != NULL) {
+    free(lexer->dfa->map);
+    free(lexer->dfa->next);
+    free(lexer->dfa->accept);
+    free(lexer->dfa);
+    lexer->dfa = NULL;
+  }
+
+  /* Terminals first, then regular expression terminals */
+  lexer_visit(lexer, symbol, &set, &count, &size);
+  lexer->terminals = lexer->count;
+  for (i = 0; i < count; i++)
+    if (set[i]->parse == parse_dfa && set[i]->dfa != NULL)
+      lexer_add(lexer, set[i]);
+  free(set);
+
+  /* One DFA for all terminals; the accepting states are labeled with
+     the terminal. A prefix of the input accepted on the way is also
+     a match */
+  lexer->ok = TRUE;
+  if (lexer->terminals > 0) {
+    memset(&re, 0, sizeof(re));
+    end = (int *) malloc(lexer->terminals * sizeof(int));
+    s = regex_node(&re);
+    for (i = 0; i < lexer->terminals; i++) {
+      n = regex_node(&re);
+      re.node[s].next = n;
+      for (np = lexer->symbol[i]->name; *np != 0; np++) {
+	re.node[n].empty = FALSE;
+	FIRST_ADD(re.node[n].set, (unsigned char) *np);
+	re.node[n].next = regex_node(&re);
+	n = re.node[n].next;
+      }
+      end[i] = n;
+      if (i + 1 < lexer->terminals) {
+	re.node[s].alt = regex_node(&re);
+	s = re.node[s].alt;
+      }
+    }
+    lexer->dfa = regex_dfa(&re, 0, end, lexer->terminals, &lexer->label);
+    lexer->ok = (lexer->dfa != NULL);
+    free(end);
+    free(re.node);
+  }
+}
+
+static void lexer_token(PARSER *parser, SYMBOL *symbol, char *end, VALUE *value)
+{
+  TOKEN *token;
+
+  if (parser->tokens == parser->token_size) {
+    parser->token_size = (parser->token_size == 0 ? 256 : parser->token_size * 2);
+    parser->token = (TOKEN *) realloc(parser->token, parser->token_size * sizeof(TOKEN));
+  }
+  token = &parser->token[parser->tokens++];
+  token->symbol = symbol;
+  token->end = end;
+  if (value != NULL)
+    token->value = *value;
+  else
+    token->value.type = VALUE_UNKNOWN_TYPE;
+}
+
+static void lexer_primitive(PARSER *parser, SYMBOL *symbol, char *input)
+{
+  VALUE value[2];
+  VALUE *output = value;
+
+  if (symbol->parse(parser, symbol, &input, &output))
+    lexer_token(parser, symbol, input, value);
+}
+
+static int lexer_scan(PARSER *parser, char *input)
+{
+  LEXER *lexer = parser->lexer;
+  int first = parser->tokens;
+  char *ip = input;
+  int i, s;
+
+  /* Scan all tokens that may start at the position; white space is
+     skipped once. The list ends with the position after the space */
+  parse_space(parser, NULL, &ip, NULL);
+  if (lexer->dfa != NULL && !INPUT_END(parser, ip)) {
+    DFA *dfa = lexer->dfa;
+    char *cp = ip;
+    for (s = 0; !INPUT_SHORT(parser, cp, ip); ) {
+      s = dfa->next[s * dfa->classes + dfa->map[(unsigned char) *cp]];
+      if (s < 0)
+	break;
+      cp++;
+      if (lexer->label[s] != 0) {
+	SYMBOL *symbol = lexer->symbol[lexer->label[s] - 1];
+	if (!symbol->keyword || parser->keywords == NULL ||
+	    !KEYWORD_CHAR(INPUT_NEXT(parser, cp, ip)))
+	  lexer_token(parser, symbol, cp, NULL);
+      }
+    }
+  }
+  /* The primitives scan the input directly */
+  parser->lexer = NULL;
+  for (i = lexer->terminals; i < lexer->count; i++)
+    lexer_primitive(parser, lexer->symbol[i], ip);
+  if (lexer->primitives & LEXER_INTEGER)
+    lexer_primitive(parser, &symbol_integer, ip);
+  if (lexer->primitives & LEXER_FLOAT)
+    lexer_primitive(parser, &symbol_float, ip);
+  if (lexer->primitives & LEXER_STRING)
+    lexer_primitive(parser, &symbol_string, ip);
+  if (lexer->primitives & LEXER_IDENTIFIER)
+    lexer_primitive(parser, &symbol_identifier, ip);
+  parser->lexer = lexer;
+  lexer_token(parser, NULL, ip, NULL);
+  return (first);
+}
+
+static int lexer_match(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  TOKEN *token;
+  int at = *input - parser->start_input;
+
+  /* Positions outside of the input are scanned directly */
+  if (at < 0 || at >= parser->lexed_size)
+    return (-1);
+  if (parser->lexed[at] < 0)
+    parser->lexed[at] = lexer_scan(parser, *input);
+
+  /* Select the token of the symbol, if any */
+  for (token = &parser->token[parser->lexed[at]]; token->symbol != NULL; token++)
+    if (token->symbol == symbol) {
+      *input = token->end;
+      if (token->value.type != VALUE_UNKNOWN_TYPE)
+	value_bind(&token->value, output);
+      return (TRUE);
+    }
+  *input = token->end;
+  return (FALSE);
+}
+
+static void lexer_start(PARSER *parser, SYMBOL *symbol, char *input)
+{
+  /* Token lists are indexed by the offset of the input position. The
+     tables are built by parse_prepare */
+  parser->lexer = symbol->lexer;
+  if (parser->lexer != NULL && (!PREPARED(symbol) || !parser->lexer->ok))
+    parser->lexer = NULL;
+  parser->token = NULL;
+  parser->tokens = 0;
+  parser->token_size = 0;
+  parser->lexed = NULL;
+  parser->lexed_size = 0;
+  if (parser->lexer == NULL)
+    return;
+  parser->lexed_size = parser->input_end - input + 1;
+  parser->lexed = (int *) malloc(parser->lexed_size * sizeof(int));
+  memset(parser->lexed, 0xff, parser->lexed_size * sizeof(int));
+}
+
+static void lexer_stop(PARSER *parser)
+{
+  free(parser->token);
+  free(parser->lexed);
+  parser->token = NULL;
+  parser->lexed = NULL;
+  parser->lexer = NULL;
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Top down parser
+ * ----------------------------------------------------------------------
+ */
+
+int parse_symbol(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  register char *ip;
+  register char *np;
+  int ok;
+  
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, symbol, input, output)) >= 0)
+    return (ok);
+
+  /* Parse white space */
+  parse_space(parser, symbol, input, output);
+  if (INPUT_END(parser, *input))
+    return (FALSE);
+
+  /* Keywords of a grammar with keywords turned on must match a whole
+     identifier; the table of the grammar gives the keyword at the
+     position. Terminals with the same name are the same keyword */
+  if (symbol->keyword && parser->keywords != NULL) {
+    SYMBOL *keyword = keyword_scan(parser, *input);
+    if (keyword == NULL ||
+	(keyword != symbol && strcmp(keyword->name, symbol->name)))
+      return (FALSE);
+    *input = parser->keyword_end;
+    return (TRUE);
+  }
+
+  /* Match with the name string */
+  ip = *input;
+  np = symbol->name;
+  while (*np != 0 && !INPUT_SHORT(parser, ip, *input) && *ip == *np) {
+    ip++;
+    np++;
+  }
+
+  /* If the match failed */
+  if (*np != 0) 
+    return (FALSE);
+
+  *input = ip;
+  return (TRUE);
+}
+
+int parse_lookahead(PARSER *parser, TERM_TYPE type, SYMBOL *symbol, char *input, VALUE *output)
+{
+  SYMBOL *error_symbol = parser->error_symbol;
+  char *error_input = parser->error_input;
+  int ok;
+
+  /* Parse from a copy of the position; the values bound are dropped */
+  if (symbol->parse == NULL)
+    ok = FALSE;
+  else if (symbol->parse == parse_syntax || symbol->parse == parse_predict)
+    ok = parse_vm(parser, symbol, &input, &output);
+  else
+    ok = symbol->parse(parser, symbol, &input, &output);
+  parser->cutting = FALSE;
+  if (type == TERM_AND_PREDICATE_TYPE)
+    return (ok);
+
+  /* A symbol that must not match does not move the error position */
+  parser->error_input = error_input;
+  parser->error_symbol = error_symbol;
+  return (!ok);
+}
+
+static int operator_climb(PARSER *parser, TERM *operand, int level, 
+			  char **input, VALUE **output);
+
+int parse_syntax(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE *old_output;
+  char *old_input;
+  unsigned long select;
+  PRODUCT *product;
+  TERM *term;
+  char *ip;
+  int cutting;
+  int run;
+  int i, n;
+  
+  /* Check that it at least has some products */
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    parser->warning = TRUE;
+    return (FALSE);
+  }
+
+  /* Check for trace and step up indentation */
+  if (parse_tracing)
+    parser->indent += INDENT_STEP;
+
+  /* Select the products that may start with the next non-space byte.
+     A trace shows all products that are tried without selection */
+  ip = *input;
+  select = ~0UL;
+  if (!parse_tracing && PREPARED(symbol) && symbol->select != NULL) {
+    ip = space_skip(parser, ip);
+    select = symbol->select[INPUT_BYTE(parser, ip)];
+    if (TRIE_ACTIVE(symbol))
+      select &= trie_select(parser, symbol->trie, ip);
+  }
+
+  /* Check each product. Backtrack if the product fails and no cut */
+  cutting = FALSE;
+  for (n = 0; symbol->syntax[n] != NULL && !cutting; n++) {
+    i = PRODUCT_ORDER(symbol, n);
+    product = symbol->syntax + i;
+    if (i < SELECT_MAX && (select & (1UL << i)) == 0) {
+      select_reject(parser, *product, ip);
+      continue;
+    }
+    old_input = *input;
+    old_output = *output;
+    
+    /* Check each term in the product */
+    for (run = TRUE, term = *product; run; term++) {
+
+      /* Check for trace of parse */
+      if (parse_tracing && term->type != TERM_PRODUCT_END_TYPE) {
+	int n = parser->indent;
+	while (n--)
+	  putchar(' ');
+	if (term->type == TERM_TERMINAL_TYPE)
+	  printf("\"%s\"\n", term->symbol->name);
+	else if (TERM_PREDICATE(term->type))
+	  printf("<%c%s>\n", (term->type == TERM_AND_PREDICATE_TYPE ? '&' : '!'),
+		 term->symbol->name);
+	else 
+	  printf("<%s>\n", term->symbol->name);
+      }
+      
+      /* A term followed by operator tables is an expression */
+      if (term->type != TERM_PRODUCT_END_TYPE && TERM_OPERATOR(term[1].type)) {
+	run = operator_climb(parser, term, 1, input, output);
+	while (TERM_OPERATOR(term[1].type))
+	  term++;
+      }
+
+      /* Decode type of term and apply */
+      else switch (term->type) {
+	case TERM_TERMINAL_TYPE:
+	  run = parse_symbol(parser, term->symbol, input, output);
+	  break;
+	case TERM_NON_TERMINAL_TYPE:
+	  if (term->symbol->parse == NULL)
+	    return (FALSE);
+	  run = term->symbol->parse(parser, term->symbol, input, output);
+	  break;
+	case TERM_ZERO_OR_ONE_TYPE:
+	  if (term->symbol->parse != NULL)
+	    term->symbol->parse(parser, term->symbol, input, output);
+	  break;
+	case TERM_ZERO_OR_MANY_TYPE:
+	  if (term->symbol->parse == NULL)
+	    return (FALSE);
+	  while (term->symbol->parse(parser, term->symbol, input, output));
+	  break;
+	case TERM_ONE_OR_MANY_TYPE:
+	  if (term->symbol->parse == NULL)
+	    return (FALSE);
+	  run = term->symbol->parse(parser, term->symbol, input, output);
+	  if (run)
+	    while (term->symbol->parse(parser, term->symbol, input, output));
+	  break;
+	case TERM_AND_PREDICATE_TYPE:
+	case TERM_NOT_PREDICATE_TYPE:
+	  run = parse_lookahead(parser, term->type, term->symbol, *input, *output);
+	  break;
+	case TERM_LEFT_OPERATOR_TYPE:
+	case TERM_RIGHT_OPERATOR_TYPE:
+	  /* Parsed with the operand above */
+	  break;
+	case TERM_PRODUCT_END_TYPE:
+	  symbol_bind(term->symbol, output);
+	  /* Step back indentation */
+	  if (parse_tracing)
+	    parser->indent -= INDENT_STEP;
+	  /* Parse was found */
+	  return (TRUE);
+      }
+
+      /* Check for cut; implicit when the later products cannot match.
+	 Memoized results before the cut are dropped */
+      if (parser->cutting) {
+	parser->cutting = FALSE;
+	cutting = TRUE;
+	parse_evict(parser, *input);
+      }
+      if (run && term - *product + 1 == PRODUCT_COMMIT(symbol, i)) {
+	cutting = TRUE;
+	parse_evict(parser, *input);
+      }
+
+      /* Capture error position; factored products and lookahead
+	 capture their own */
+      if (*input >= parser->error_input && TERM_ERROR(term)->origin == NULL &&
+	  !TERM_PREDICATE(term->type)) {
+	parser->error_input = *input;
+	parser->error_symbol = TERM_ERROR(term);
+      }
+    }
+
+    /* Back-track and try next product */
+    *input = old_input;
+    *output = old_output;
+  }
+
+  /* Step back indentation */
+  if (parse_tracing)
+    parser->indent -= INDENT_STEP;
+
+  /* Parse failed */
+  return (FALSE);
+}
+
+/* Initial depth of the symbol stack; doubled on the heap when full */
+#define PREDICT_DEPTH 64
+#define PREDICTIVE(s) ((s)->parse == parse_predict && PREPARED(s))
+
+typedef struct {
+  TERM *term;
+  int loop;
+} PREDICT;
+
+static TERM *predict_product(PARSER *parser, SYMBOL *symbol, char *input)
+{
+  int n;
+
+  /* Product selected by the next non-space byte. If none, the error
+     is captured as if all products had been rejected by selection */
+  input = space_skip(parser, input);
+  n = symbol->predict[INPUT_BYTE(parser, input)];
+  if (n == 0) {
+    for (n = 0; symbol->syntax[n] != NULL; n++)
+      select_reject(parser, symbol->syntax[PRODUCT_ORDER(symbol, n)], input);
+    return (NULL);
+  }
+  return (symbol->syntax[n - 1]);
+}
+
+static PREDICT *predict_grow(PREDICT *stack, PREDICT *local, int *size)
+{
+  PREDICT *grown = (PREDICT *) malloc(*size * 2 * sizeof(PREDICT));
+  
+  memcpy(grown, stack, *size * sizeof(PREDICT));
+  if (stack != local)
+    free(stack);
+  *size *= 2;
+  return (grown);
+}
+
+int parse_predict(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  PREDICT local[PREDICT_DEPTH];
+  PREDICT *stack = local;
+  VALUE *old_output = *output;
+  char *old_input = *input;
+  TERM *next;
+  TERM *term;
+  SYMBOL *s;
+  int size = PREDICT_DEPTH;
+  int sp = 0;
+  int run;
+  
+  /* Trace or tables not up to date; use the back-tracking parser */
+  if (parse_tracing || !PREDICTIVE(symbol))
+    return (parse_syntax(parser, symbol, input, output));
+
+  /* Run the predicted products. LL(1) symbols are pushed on the stack */
+  term = predict_product(parser, symbol, *input);
+  for (run = (term != NULL); run; term++) {
+    s = term->symbol;
+    switch (term->type) {
+      case TERM_TERMINAL_TYPE:
+	run = parse_symbol(parser, s, input, output);
+	break;
+      case TERM_NON_TERMINAL_TYPE:
+      case TERM_ONE_OR_MANY_TYPE:
+	if (PREDICTIVE(s)) {
+	  next = predict_product(parser, s, *input);
+	  if (next == NULL) {
+	    run = FALSE;
+	    break;
+	  }
+	  if (sp == size)
+	    stack = predict_grow(stack, local, &size);
+	  stack[sp].term = term;
+	  stack[sp++].loop = (term->type == TERM_ONE_OR_MANY_TYPE);
+	  term = next - 1;
+	  continue;
+	}
+	if (s->parse == NULL)
+	  run = FALSE;
+	else 
+	  run = s->parse(parser, s, input, output);
+	if (run && term->type == TERM_ONE_OR_MANY_TYPE)
+	  while (s->parse(parser, s, input, output));
+	break;
+      case TERM_ZERO_OR_ONE_TYPE:
+      case TERM_ZERO_OR_MANY_TYPE:
+	if (PREDICTIVE(s)) {
+	  next = predict_product(parser, s, *input);
+	  if (next == NULL)
+	    break;
+	  if (sp == size)
+	    stack = predict_grow(stack, local, &size);
+	  stack[sp].term = term;
+	  stack[sp++].loop = (term->type == TERM_ZERO_OR_MANY_TYPE);
+	  term = next - 1;
+	  continue;
+	}
+	if (s->parse == NULL)
+	  run = (term->type == TERM_ZERO_OR_ONE_TYPE);
+	else if (term->type == TERM_ZERO_OR_ONE_TYPE)
+	  s->parse(parser, s, input, output);
+	else
+	  while (s->parse(parser, s, input, output));
+	break;
+      case TERM_AND_PREDICATE_TYPE:
+      case TERM_NOT_PREDICATE_TYPE:
+	/* Symbols with predicates are not pure and thus not predicted;
+	   evaluated without consuming input if the analysis allows them */
+	run = parse_lookahead(parser, term->type, s, *input, *output);
+	break;
+      case TERM_LEFT_OPERATOR_TYPE:
+      case TERM_RIGHT_OPERATOR_TYPE:
+	/* Symbols with operator tables are not predicted */
+	run = FALSE;
+	break;
+      case TERM_PRODUCT_END_TYPE:
+	symbol_bind(s, output);
+	if (sp == 0) {
+	  if (stack != local)
+	    free(stack);
+	  return (TRUE);
+	}
+	term = stack[--sp].term;
+	if (stack[sp].loop) {
+	  next = predict_product(parser, term->symbol, *input);
+	  if (next != NULL) {
+	    sp++;
+	    term = next - 1;
+	    continue;
+	  }
+	}
+	break;
+    }
+
+    /* Cut only applies to back-tracking */
+    parser->cutting = FALSE;
+
+    /* Capture error position */
+    if (*input >= parser->error_input && TERM_ERROR(term)->origin == NULL) {
+      parser->error_input = *input;
+      parser->error_symbol = TERM_ERROR(term);
+    }
+  }
+
+  /* The symbol is LL(1) and without side effects; back-tracking would
+     also fail. The error is captured where the prediction failed */
+  if (stack != local)
+    free(stack);
+  *input = old_input;
+  *output = old_output;
+  return (FALSE);
+}
+
+int parse_memo(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE *old_output = *output;
+  char *old_input = *input;
+  MEMO *memo;
+  int ok;
+
+  /* Replay the result if the symbol was parsed at this position */
+  memo = memo_lookup(parser, symbol, old_input);
+  if (memo != NULL)
+    return (memo_replay(parser, memo, input, output));
+
+  /* Parse and capture result. Output rewound by <execute> is not kept */
+  ok = parse_syntax(parser, symbol, input, output);
+  if (*output >= old_output)
+    memo_store(parser, memo_insert(parser, symbol, old_input),
+	       ok ? *input : NULL,
+	       old_output,
+	       *output - old_output);
+  return (ok);
+}
+
+int parse_left_recursive(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE *old_output = *output;
+  char *old_input = *input;
+  MEMO *memo;
+  int ok;
+
+  /* Replay the seed, or the grown parse, at this position */
+  memo = memo_lookup(parser, symbol, old_input);
+  if (memo != NULL)
+    return (memo_replay(parser, memo, input, output));
+
+  /* Plant a failed seed and grow it while the parse gets longer */
+  memo_insert(parser, symbol, old_input)->growing = TRUE;
+  for (;;) {
+    ok = parse_syntax(parser, symbol, input, output);
+    memo = memo_lookup(parser, symbol, old_input);
+    if (memo == NULL)
+      return (ok);
+    if (!ok || (memo->end != NULL && *input <= memo->end))
+      break;
+    memo_store(parser, memo, *input, old_output, *output - old_output);
+    *input = old_input;
+    *output = old_output;
+  }
+
+  /* Use the longest parse */
+  memo->growing = FALSE;
+  *input = old_input;
+  *output = old_output;
+  return (memo_replay(parser, memo, input, output));
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Operator precedence parser (precedence climbing)
+ * ----------------------------------------------------------------------
+ */
+
+static int operator_term(PARSER *parser, TERM *term, char **input, VALUE **output)
+{
+  SYMBOL *symbol = term->symbol;
+  int ok;
+
+  /* Match a term as the back-tracking parser. A cut is left in
+     parser->cutting for the product */
+  ok = TRUE;
+  switch (term->type) {
+    case TERM_TERMINAL_TYPE:
+      ok = parse_symbol(parser, symbol, input, output);
+      break;
+    case TERM_NON_TERMINAL_TYPE:
+      ok = (symbol->parse != NULL && symbol->parse(parser, symbol, input, output));
+      break;
+    case TERM_ZERO_OR_ONE_TYPE:
+      if (symbol->parse != NULL)
+	symbol->parse(parser, symbol, input, output);
+      break;
+    case TERM_ZERO_OR_MANY_TYPE:
+      if (symbol->parse == NULL)
+	ok = FALSE;
+      else
+	while (symbol->parse(parser, symbol, input, output));
+      break;
+    case TERM_ONE_OR_MANY_TYPE:
+      ok = (symbol->parse != NULL && symbol->parse(parser, symbol, input, output));
+      if (ok)
+	while (symbol->parse(parser, symbol, input, output));
+      break;
+    case TERM_AND_PREDICATE_TYPE:
+    case TERM_NOT_PREDICATE_TYPE:
+      return (parse_lookahead(parser, term->type, symbol, *input, *output));
+    default:
+      ok = FALSE;
+      break;
+  }
+
+  /* Capture error position */
+  if (*input >= parser->error_input && symbol->origin == NULL) {
+    parser->error_input = *input;
+    parser->error_symbol = symbol;
+  }
+  return (ok);
+}
+
+static int operator_apply(PARSER *parser, TERM *operand, TERM *term, int level,
+			  char **input, VALUE **output)
+{
+  VALUE *old_output;
+  char *old_input;
+  PRODUCT *product;
+  int cutting = FALSE;
+  int ok;
+
+  /* Match the operator. The products of a factored operator are
+     alternatives. A failed product leaves parser->cutting set if it
+     was cut; the other products of the table are then not tried */
+  for (; term->type != TERM_PRODUCT_END_TYPE; term++) {
+    if (term->type == TERM_NON_TERMINAL_TYPE &&
+	term->symbol->origin != NULL &&
+	term->symbol->syntax != NULL &&
+	term[1].type == TERM_PRODUCT_END_TYPE) {
+      old_input = *input;
+      old_output = *output;
+      for (product = term->symbol->syntax; *product != NULL; product++) {
+	if (operator_apply(parser, operand, *product, level, input, output))
+	  return (TRUE);
+	*input = old_input;
+	*output = old_output;
+	if (parser->cutting)
+	  break;
+      }
+      parser->cutting |= cutting;
+      return (FALSE);
+    }
+    ok = operator_term(parser, term, input, output);
+    if (parser->cutting) {
+      parser->cutting = FALSE;
+      cutting = TRUE;
+      parse_evict(parser, *input);
+    }
+    if (!ok) {
+      parser->cutting = cutting;
+      return (FALSE);
+    }
+  }
+
+  /* Right operand and then the semantic action of the operator */
+  if (!operator_climb(parser, operand, level, input, output)) {
+    parser->cutting = cutting;
+    return (FALSE);
+  }
+  symbol_bind(term->symbol, output);
+  return (TRUE);
+}
+
+static int operator_climb(PARSER *parser, TERM *operand, int level, 
+			  char **input, VALUE **output)
+{
+  VALUE *old_output;
+  char *old_input;
+  unsigned long select;
+  PRODUCT *product;
+  SYMBOL *table;
+  TERM *term;
+  int cutting;
+  int i, k, n;
+
+  /* Operand followed by operators of the level or higher. The last
+     operator table has the highest precedence and is tried first */
+  if (!operator_term(parser, operand, input, output))
+    return (FALSE);
+  parser->cutting = FALSE;
+  for (n = 1; TERM_OPERATOR(operand[n].type); n++);
+  do {
+    for (i = n - 1; i >= level; i--) {
+      term = &operand[i];
+      table = term->symbol;
+      if (table->syntax == NULL)
+	continue;
+      select = (TRIE_ACTIVE(table) ?
+		trie_select(parser, table->trie, space_skip(parser, *input)) : ~0UL);
+      for (cutting = FALSE, k = 0; table->syntax[k] != NULL && !cutting; k++) {
+	product = table->syntax + PRODUCT_ORDER(table, k);
+	if (product - table->syntax < SELECT_MAX &&
+	    (select & (1UL << (product - table->syntax))) == 0)
+	  continue;
+	old_input = *input;
+	old_output = *output;
+	if (operator_apply(parser, operand, *product,
+			   (term->type == TERM_LEFT_OPERATOR_TYPE ? i + 1 : i),
+			   input, output))
+	  break;
+	*input = old_input;
+	*output = old_output;
+	cutting = parser->cutting;
+	parser->cutting = FALSE;
+      }
+      if (!cutting && table->syntax[k] != NULL)
+	break;
+    }
+  } while (i >= level);
+  return (TRUE);
+}
+
+int parse_operator(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE *old_output;
+  char *old_input;
+  PRODUCT *product;
+  TERM *term;
+  int cutting;
+  int ok;
+
+  /* Check that it at least has some products */
+  if (symbol->syntax == NULL) {
+    printf("<%s>: undefined\n", symbol->name);
+    parser->warning = TRUE;
+    return (FALSE);
+  }
+
+  /* Check each product; a term followed by operators is an expression.
+     Backtrack if the product fails and no cut */
+  cutting = FALSE;
+  for (product = symbol->syntax; *product != NULL && !cutting; product++) {
+    old_input = *input;
+    old_output = *output;
+    for (ok = TRUE, term = *product; ok && term->type != TERM_PRODUCT_END_TYPE; term++) {
+      if (TERM_OPERATOR(term[1].type)) {
+	ok = operator_climb(parser, term, 1, input, output);
+	while (TERM_OPERATOR(term[1].type))
+	  term++;
+      }
+      else
+	ok = operator_term(parser, term, input, output);
+      if (parser->cutting) {
+	parser->cutting = FALSE;
+	cutting = TRUE;
+	parse_evict(parser, *input);
+      }
+    }
+    if (ok) {
+      symbol_bind(term->symbol, output);
+      return (TRUE);
+    }
+    *input = old_input;
+    *output = old_output;
+  }
+  return (FALSE);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Earley parser (general context free grammar, cubic time)
+ * ----------------------------------------------------------------------
+ */
+
+typedef struct ITEM ITEM;
+
+struct ITEM {
+  TERM *term;
+  SYMBOL *symbol;
+  int origin;
+  int end;
+  int rep;
+  int prev;
+  int child;
+  int scan;
+  int next;
+  int link;
+};
+
+typedef struct {
+  PARSER *parser;
+  char *input;
+  int length;
+  int last;
+  int pure;
+  ITEM *item;
+  int items;
+  int size;
+  int *bucket;
+  int buckets;
+  int *head;
+  int *tail;
+} CHART;
+
+static int earley_hash(CHART *chart, TERM *term, int origin, int end, int rep)
+{
+  unsigned long key = (unsigned long) term >> 3;
+  key = ((key * 31 + origin) * 31 + end) * 2 + rep;
+  return (key % chart->buckets);
+}
+
+static void earley_add(CHART *chart, TERM *term, SYMBOL *symbol, int origin,
+		       int end, int rep, int prev, int child, int scan)
+{
+  ITEM *item;
+  int i, n;
+
+  /* Check if the item is already in the set */
+  n = earley_hash(chart, term, origin, end, rep);
+  for (i = chart->bucket[n]; i >= 0; i = item->link) {
+    item = &chart->item[i];
+    if (item->term == term && item->origin == origin && 
+	item->end == end && item->rep == rep)
+      return;
+  }
+
+  /* Grow the item vector and the hash table */
+  if (chart->items == chart->size) {
+    chart->size *= 2;
+    chart->item = (ITEM *) realloc(chart->item, chart->size * sizeof(ITEM));
+    free(chart->bucket);
+    chart->buckets = chart->size * 2 + 1;
+    chart->bucket = (int *) malloc(chart->buckets * sizeof(int));
+    memset(chart->bucket, -1, chart->buckets * sizeof(int));
+    for (i = 0; i < chart->items; i++) {
+      item = &chart->item[i];
+      n = earley_hash(chart, item->term, item->origin, item->end, item->rep);
+      item->link = chart->bucket[n];
+      chart->bucket[n] = i;
+    }
+    n = earley_hash(chart, term, origin, end, rep);
+  }
+
+  /* Append the item to the set and the hash bucket */
+  i = chart->items++;
+  item = &chart->item[i];
+  item->term = term;
+  item->symbol = symbol;
+  item->origin = origin;
+  item->end = end;
+  item->rep = rep;
+  item->prev = prev;
+  item->child = child;
+  item->scan = scan;
+  item->next = -1;
+  item->link = chart->bucket[n];
+  chart->bucket[n] = i;
+  if (chart->head[end] < 0)
+    chart->head[end] = i;
+  else
+    chart->item[chart->tail[end]].next = i;
+  chart->tail[end] = i;
+  if (end > chart->last)
+    chart->last = end;
+}
+
+static void earley_advance(CHART *chart, int i, int end, int child, int scan)
+{
+  ITEM *item = &chart->item[i];
+  TERM *term = item->term;
+
+  /* Repetitions keep the dot and may continue */
+  if (term->type == TERM_ZERO_OR_MANY_TYPE || term->type == TERM_ONE_OR_MANY_TYPE)
+    earley_add(chart, term, item->symbol, item->origin, end,
+	       term->type == TERM_ONE_OR_MANY_TYPE, i, child, scan);
+  else
+    earley_add(chart, term + 1, item->symbol, item->origin, end,
+	       0, i, child, scan);
+}
+
+static int earley_scan(CHART *chart, TERM *term, int at, VALUE **output)
+{
+  SYMBOL *symbol = term->symbol;
+  char *ip = chart->input + at;
+  int ok;
+
+  /* Terminals and primitives are matched directly in the input */
+  if (term->type == TERM_TERMINAL_TYPE)
+    ok = parse_symbol(chart->parser, symbol, &ip, output);
+  else if (symbol->parse == parse_throw)
+    ok = FALSE;
+  else if (!primitive_pure(symbol->parse)) {
+    chart->pure = FALSE;
+    ok = FALSE;
+  }
+  else {
+    ok = symbol->parse(chart->parser, symbol, &ip, output);
+    chart->parser->cutting = FALSE;
+  }
+  return (ok ? ip - chart->input : -1);
+}
+
+static void earley_process(CHART *chart, int i, int at)
+{
+  VALUE scratch[4];
+  VALUE *output;
+  PRODUCT *product;
+  SYMBOL *symbol;
+  TERM *term;
+  int origin;
+  int end;
+  int k;
+
+  term = chart->item[i].term;
+  symbol = term->symbol;
+  switch (term->type) {
+    case TERM_PRODUCT_END_TYPE:
+      /* Complete; move the dot of the items waiting for the symbol */
+      symbol = chart->item[i].symbol;
+      origin = chart->item[i].origin;
+      for (k = chart->head[origin]; k >= 0; k = chart->item[k].next) {
+	term = chart->item[k].term;
+	if (term->type != TERM_TERMINAL_TYPE &&
+	    term->type != TERM_PRODUCT_END_TYPE &&
+	    term->symbol == symbol)
+	  earley_advance(chart, k, at, i, FALSE);
+      }
+      return;
+    case TERM_TERMINAL_TYPE:
+      /* Scan */
+      output = scratch;
+      end = earley_scan(chart, term, at, &output);
+      if (end >= 0)
+	earley_advance(chart, i, end, -1, TRUE);
+      return;
+    case TERM_AND_PREDICATE_TYPE:
+    case TERM_NOT_PREDICATE_TYPE:
+      /* Lookahead is parsed with back-tracking */
+      chart->pure = FALSE;
+      return;
+    default:
+      if (symbol->syntax == NULL || symbol->parse == NULL ||
+	  symbol->parse == parse_operator) {
+	output = scratch;
+	end = earley_scan(chart, term, at, &output);
+	if (end >= 0)
+	  earley_advance(chart, i, end, -1, TRUE);
+      }
+      else {
+	/* Predict, and use completions that did not consume input */
+	for (product = symbol->syntax; *product != NULL; product++)
+	  earley_add(chart, *product, symbol, at, at, 0, -1, -1, FALSE);
+	for (k = chart->head[at]; k >= 0; k = chart->item[k].next)
+	  if (chart->item[k].term->type == TERM_PRODUCT_END_TYPE &&
+	      chart->item[k].symbol == symbol &&
+	      chart->item[k].origin == at)
+	    earley_advance(chart, i, at, k, FALSE);
+      }
+
+      /* Zero or one, zero or many, and one or many when one is done */
+      if (term->type == TERM_ZERO_OR_ONE_TYPE ||
+	  term->type == TERM_ZERO_OR_MANY_TYPE ||
+	  (term->type == TERM_ONE_OR_MANY_TYPE && chart->item[i].rep))
+	earley_add(chart, term + 1, chart->item[i].symbol, 
+		   chart->item[i].origin, at, 0, i, -1, FALSE);
+      return;
+  }
+}
+
+static void earley_emit(CHART *chart, int i, VALUE **output)
+{
+  ITEM *item = &chart->item[i];
+  ITEM *prev;
+  char *ip;
+
+  /* Generate code for the terms before the dot, then the semantic */
+  if (item->prev >= 0) {
+    earley_emit(chart, item->prev, output);
+    prev = &chart->item[item->prev];
+    if (item->child >= 0)
+      earley_emit(chart, item->child, output);
+    else if (item->scan && prev->term->type != TERM_TERMINAL_TYPE) {
+      ip = chart->input + prev->end;
+      prev->term->symbol->parse(chart->parser, prev->term->symbol, &ip, output);
+      chart->parser->cutting = FALSE;
+    }
+  }
+  if (item->term->type == TERM_PRODUCT_END_TYPE)
+    symbol_bind(item->term->symbol, output);
+}
+
+int parse_earley(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  PRODUCT *product;
+  CHART chart;
+  ITEM *item;
+  char *ip;
+  int best;
+  int i, j;
+  
+  /* Check that it at least has some products */
+  if (symbol->syntax == NULL)
+    return (parse_syntax(parser, symbol, input, output));
+  
+  /* Allocate the chart; one item set per input position */
+  chart.parser = parser;
+  chart.input = *input;
+  chart.length = parser->input_end - *input;
+  chart.last = 0;
+  chart.pure = TRUE;
+  chart.items = 0;
+  chart.size = 256;
+  chart.item = (ITEM *) malloc(chart.size * sizeof(ITEM));
+  chart.buckets = chart.size * 2 + 1;
+  chart.bucket = (int *) malloc(chart.buckets * sizeof(int));
+  memset(chart.bucket, -1, chart.buckets * sizeof(int));
+  chart.head = (int *) malloc((chart.length + 1) * sizeof(int));
+  chart.tail = (int *) malloc((chart.length + 1) * sizeof(int));
+  memset(chart.head, -1, (chart.length + 1) * sizeof(int));
+
+  /* Process the item sets. Keep the longest parse of the symbol */
+  for (product = symbol->syntax; *product != NULL; product++)
+    earley_add(&chart, *product, symbol, 0, 0, 0, -1, -1, FALSE);
+  best = -1;
+  for (j = 0; j <= chart.last && chart.pure; j++) {
+    for (i = chart.head[j]; i >= 0 && chart.pure; i = chart.item[i].next)
+      earley_process(&chart, i, j);
+    for (i = chart.head[j]; i >= 0; i = chart.item[i].next) {
+      item = &chart.item[i];
+      if (item->term->type == TERM_PRODUCT_END_TYPE &&
+	  item->symbol == symbol && item->origin == 0) {
+	best = i;
+	break;
+      }
+    }
+  }
+
+  /* Generate code for the first derivation found, or capture error */
+  if (chart.pure) {
+    if (best >= 0) {
+      earley_emit(&chart, best, output);
+      *input = chart.input + chart.item[best].end;
+    }
+    else {
+      ip = space_skip(parser, chart.input + chart.last);
+      for (i = chart.head[chart.last]; i >= 0; i = item->next) {
+	item = &chart.item[i];
+	if (item->term->type != TERM_PRODUCT_END_TYPE) {
+	  if (ip >= parser->error_input) {
+	    parser->error_input = ip;
+	    parser->error_symbol = TERM_ERROR(item->term);
+	  }
+	  break;
+	}
+      }
+    }
+  }
+  free(chart.item);
+  free(chart.bucket);
+  free(chart.head);
+  free(chart.tail);
+
+  /* Side effects in the grammar; use the back-tracking parser */
+  if (!chart.pure)
+    return (parse_syntax(parser, symbol, input, output));
+  return (best >= 0);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: LALR(1) parser (yacc grammars, shift-reduce tables)
+ * ----------------------------------------------------------------------
+ */
+
+/* Grammar symbol codes; non-terminals >= 0, terminals < 0 */
+#define LALR_TERMINAL(x) ((x) < 0)
+#define LALR_CODE(t) (-(t) - 1)
+#define LALR_END (INT_MAX)
+#define LALR_BIT_SET(set, n) ((set)[(n) >> 3] |= (1 << ((n) & 7)))
+#define LALR_BIT_HAS(set, n) ((set)[(n) >> 3] & (1 << ((n) & 7)))
+#define LALR_UNKNOWN (&lalr_unknown)
+
+static char lalr_unknown;
+
+struct LALR {
+  int supported;
+  int conflicts;
+  int terminals;
+  TERM *terminal;
+  int nonterminals;
+  int rules;
+  int *lhs;
+  int *length;
+  SYMBOL **semantic;
+  int states;
+  int *action;
+  int *go;
+  SYMBOL **expect;
+};
+
+typedef struct {
+  LALR *lalr;
+  int size;
+  SYMBOL **symbol;
+  int *type;
+  int *element;
+  int rhs_size;
+  int rhss;
+  int *rhs;
+  int *start;
+  int rules_size;
+  int width;
+  unsigned char *first;
+  unsigned char *nullable;
+  int items;
+  int *item_rule;
+  int *item_next;
+  int *item_start;
+} GRAMMAR;
+
+static void *lalr_grow(void *vector, int *size, int count, int element)
+{
+  /* Double the vector until it holds count elements */
+  if (count < *size)
+    return (vector);
+  while (count >= *size)
+    *size = (*size == 0 ? 16 : *size * 2);
+  return (realloc(vector, *size * element));
+}
+
+static int lalr_terminal(GRAMMAR *grammar, TERM_TYPE type, SYMBOL *symbol)
+{
+  LALR *lalr = grammar->lalr;
+  int size = lalr->terminals;
+  int t;
+
+  /* Literal strings and scanning symbols are terminals */
+  for (t = 0; t < lalr->terminals; t++)
+    if (lalr->terminal[t].type == type && lalr->terminal[t].symbol == symbol)
+      return (LALR_CODE(t));
+  if (type != TERM_TERMINAL_TYPE &&
+      (symbol->syntax != NULL ? !symbol->pure : !primitive_pure(symbol->parse)))
+    lalr->supported = FALSE;
+  lalr->terminal = (TERM *) realloc(lalr->terminal, (size + 1) * sizeof(TERM));
+  lalr->terminal[t].type = type;
+  lalr->terminal[t].symbol = symbol;
+  lalr->terminal[t].error = NULL;
+  lalr->terminals++;
+  return (LALR_CODE(t));
+}
+
+static int lalr_nonterminal(GRAMMAR *grammar, SYMBOL *symbol, int type, int element)
+{
+  LALR *lalr = grammar->lalr;
+  int n;
+
+  /* Yacc symbols and synthesized repetitions are non-terminals */
+  for (n = 0; n < lalr->nonterminals; n++)
+    if (grammar->symbol[n] == symbol &&
+	grammar->type[n] == type && grammar->element[n] == element)
+      return (n);
+  grammar->symbol = (SYMBOL **) lalr_grow(grammar->symbol, &grammar->size, n, sizeof(SYMBOL *));
+  grammar->type = (int *) realloc(grammar->type, grammar->size * sizeof(int));
+  grammar->element = (int *) realloc(grammar->element, grammar->size * sizeof(int));
+  grammar->symbol[n] = symbol;
+  grammar->type[n] = type;
+  grammar->element[n] = element;
+  lalr->nonterminals++;
+  return (n);
+}
+
+static int lalr_element(GRAMMAR *grammar, TERM *term)
+{
+  SYMBOL *symbol = term->symbol;
+  
+  /* Map a term to a grammar symbol code; empty is ignored */
+  if (term->type == TERM_TERMINAL_TYPE)
+    return (lalr_terminal(grammar, TERM_TERMINAL_TYPE, symbol));
+  if (symbol->parse == parse_empty)
+    return (LALR_END);
+  if (symbol->parse == parse_lalr && symbol->syntax != NULL)
+    return (lalr_nonterminal(grammar, symbol, TERM_NON_TERMINAL_TYPE, 0));
+  return (lalr_terminal(grammar, TERM_NON_TERMINAL_TYPE, symbol));
+}
+
+static void lalr_rule(GRAMMAR *grammar, int lhs, int *rhs, int length, SYMBOL *semantic)
+{
+  LALR *lalr = grammar->lalr;
+  int r = lalr->rules;
+
+  /* Append rule; right hand sides are kept in a single vector */
+  if (r == grammar->rules_size) {
+    grammar->rules_size = (r == 0 ? 16 : r * 2);
+    lalr->lhs = (int *) realloc(lalr->lhs, grammar->rules_size * sizeof(int));
+    lalr->length = (int *) realloc(lalr->length, grammar->rules_size * sizeof(int));
+    lalr->semantic = (SYMBOL **) realloc(lalr->semantic, 
+					 grammar->rules_size * sizeof(SYMBOL *));
+    grammar->start = (int *) realloc(grammar->start, grammar->rules_size * sizeof(int));
+  }
+  grammar->rhs = (int *) lalr_grow(grammar->rhs, &grammar->rhs_size, 
+				   grammar->rhss + length, sizeof(int));
+  lalr->lhs[r] = lhs;
+  lalr->length[r] = length;
+  lalr->semantic[r] = semantic;
+  grammar->start[r] = grammar->rhss;
+  memcpy(grammar->rhs + grammar->rhss, rhs, length * sizeof(int));
+  grammar->rhss += length;
+  lalr->rules++;
+}
+
+static void lalr_rules(GRAMMAR *grammar, int n)
+{
+  SYMBOL *symbol = grammar->symbol[n];
+  int element = grammar->element[n];
+  PRODUCT *product;
+  TERM *term;
+  int rhs[64];
+  int length;
+  int e;
+  
+  /* Repetitions; N ::= | B, N ::= | N B, and N ::= B | N B */
+  rhs[0] = n;
+  rhs[1] = element;
+  switch (grammar->type[n]) {
+  case TERM_ZERO_OR_ONE_TYPE:
+    lalr_rule(grammar, n, rhs, 0, NULL);
+    lalr_rule(grammar, n, rhs + 1, 1, NULL);
+    return;
+  case TERM_ZERO_OR_MANY_TYPE:
+    lalr_rule(grammar, n, rhs, 0, NULL);
+    lalr_rule(grammar, n, rhs, 2, NULL);
+    return;
+  case TERM_ONE_OR_MANY_TYPE:
+    lalr_rule(grammar, n, rhs + 1, 1, NULL);
+    lalr_rule(grammar, n, rhs, 2, NULL);
+    return;
+  default:
+    break;
+  }
+
+  /* Products of the yacc symbol */
+  for (product = symbol->syntax; *product != NULL; product++) {
+    length = 0;
+    for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+      if (TERM_PREDICATE(term->type)) {
+	grammar->lalr->supported = FALSE;
+	return;
+      }
+      e = lalr_element(grammar, term);
+      if (e == LALR_END)
+	continue;
+      if (term->type != TERM_TERMINAL_TYPE && term->type != TERM_NON_TERMINAL_TYPE)
+	e = lalr_nonterminal(grammar, NULL, term->type, e);
+      if (length == 64) {
+	grammar->lalr->supported = FALSE;
+	return;
+      }
+      rhs[length++] = e;
+    }
+    lalr_rule(grammar, n, rhs, length, term->symbol);
+  }
+}
+
+static void lalr_first(GRAMMAR *grammar)
+{
+  LALR *lalr = grammar->lalr;
+  int width = grammar->width;
+  unsigned char *first;
+  int changed;
+  int r, i, e, c;
+
+  /* FIRST sets and nullability of non-terminals; fixpoint iteration */
+  grammar->first = (unsigned char *) calloc(lalr->nonterminals, width);
+  grammar->nullable = (unsigned char *) calloc(lalr->nonterminals, 1);
+  do {
+    changed = FALSE;
+    for (r = 0; r < lalr->rules; r++) {
+      first = grammar->first + lalr->lhs[r] * width;
+      for (i = 0; i < lalr->length[r]; i++) {
+	e = grammar->rhs[grammar->start[r] + i];
+	if (LALR_TERMINAL(e)) {
+	  if (!LALR_BIT_HAS(first, LALR_CODE(e))) {
+	    LALR_BIT_SET(first, LALR_CODE(e));
+	    changed = TRUE;
+	  }
+	  break;
+	}
+	for (c = 0; c < width; c++) 
+	  if ((first[c] | grammar->first[e * width + c]) != first[c]) {
+	    first[c] |= grammar->first[e * width + c];
+	    changed = TRUE;
+	  }
+	if (!grammar->nullable[e])
+	  break;
+      }
+      if (i == lalr->length[r] && !grammar->nullable[lalr->lhs[r]]) {
+	grammar->nullable[lalr->lhs[r]] = TRUE;
+	changed = TRUE;
+      }
+    }
+  } while (changed);
+}
+
+static void lalr_items(GRAMMAR *grammar)
+{
+  LALR *lalr = grammar->lalr;
+  int r, d, i;
+
+  /* Items are numbered rule by rule; one per dot position */
+  grammar->item_start = (int *) malloc(lalr->rules * sizeof(int));
+  grammar->items = lalr->rules + grammar->rhss;
+  grammar->item_rule = (int *) malloc(grammar->items * sizeof(int));
+  grammar->item_next = (int *) malloc(grammar->items * sizeof(int));
+  for (i = 0, r = 0; r < lalr->rules; r++) {
+    grammar->item_start[r] = i;
+    for (d = 0; d <= lalr->length[r]; d++, i++) {
+      grammar->item_rule[i] = r;
+      grammar->item_next[i] = (d < lalr->length[r] ?
+			       grammar->rhs[grammar->start[r] + d] : LALR_END);
+    }
+  }
+}
+
+static int lalr_closure(GRAMMAR *grammar, int *item, int count, 
+			unsigned char *la, int *mark, int stamp)
+{
+  LALR *lalr = grammar->lalr;
+  int width = grammar->width;
+  unsigned char set[PARSE_FIRST_SIZE * 8];
+  unsigned char *from;
+  int i, j, k, r, e, c, n;
+  int changed;
+
+  /* Closure of an item set; la holds the lookahead per item when given */
+  for (i = 0; i < count; i++)
+    mark[item[i]] = stamp;
+  do {
+    changed = FALSE;
+    for (i = 0; i < count; i++) {
+      n = grammar->item_next[item[i]];
+      if (n == LALR_END || LALR_TERMINAL(n))
+	continue;
+      if (la != NULL) {
+	from = la + item[i] * width;
+	memset(set, 0, width);
+	for (k = item[i] + 1; grammar->item_next[k] != LALR_END; k++) {
+	  e = grammar->item_next[k];
+	  if (LALR_TERMINAL(e)) {
+	    LALR_BIT_SET(set, LALR_CODE(e));
+	    break;
+	  }
+	  for (c = 0; c < width; c++)
+	    set[c] |= grammar->first[e * width + c];
+	  if (!grammar->nullable[e])
+	    break;
+	}
+	if (grammar->item_next[k] == LALR_END)
+	  for (c = 0; c < width; c++)
+	    set[c] |= from[c];
+      }
+      for (r = 0; r < lalr->rules; r++) {
+	if (lalr->lhs[r] != n)
+	  continue;
+	j = grammar->item_start[r];
+	if (mark[j] != stamp) {
+	  mark[j] = stamp;
+	  if (la != NULL)
+	    memset(la + j * width, 0, width);
+	  item[count++] = j;
+	  changed = TRUE;
+	}
+	if (la != NULL) 
+	  for (c = 0; c < width; c++)
+	    if ((la[j * width + c] | set[c]) != la[j * width + c]) {
+	      la[j * width + c] |= set[c];
+	      changed = TRUE;
+	    }
+      }
+    }
+  } while (changed);
+  return (count);
+}
+
+static SYMBOL *lalr_symbol(GRAMMAR *grammar, int x)
+{
+  /* Source symbol of a grammar symbol code; repetitions by element */
+  if (LALR_TERMINAL(x))
+    return (grammar->lalr->terminal[LALR_CODE(x)].symbol);
+  if (grammar->symbol[x] != NULL)
+    return (grammar->symbol[x]);
+  return (lalr_symbol(grammar, grammar->element[x]));
+}
+
+static void lalr_action(LALR *lalr, int s, int t, int action)
+{
+  int *entry = &lalr->action[s * (lalr->terminals + 1) + t];
+
+  /* Resolve conflicts; shift before reduce, earlier rule first */
+  if (*entry == 0 || *entry == action)
+    *entry = action;
+  else {
+    lalr->conflicts++;
+    if (action > 0 || (*entry < 0 && action > *entry))
+      *entry = action;
+  }
+}
+
+static void lalr_build(LALR *lalr, SYMBOL *symbol)
+{
+  GRAMMAR grammar;
+  int *kernel = NULL;
+  int kernel_size = 0;
+  int kernels = 0;
+  int *state = NULL;
+  int state_size = 0;
+  int *edge = NULL;
+  int edge_size = 0;
+  int edges = 0;
+  int *prop = NULL;
+  int prop_size = 0;
+  int props = 0;
+  unsigned char *la;
+  unsigned char *scratch;
+  int *item;
+  int *mark;
+  int stamp = 0;
+  int width, T, N;
+  int s, t, i, j, k, n, e, x, count, changed;
+
+  /* Extract the grammar; rule zero is the augmented start rule */
+  memset(&grammar, 0, sizeof(grammar));
+  grammar.lalr = lalr;
+  lalr->supported = TRUE;
+  lalr_nonterminal(&grammar, NULL, TERM_PRODUCT_END_TYPE, 0);
+  x = lalr_nonterminal(&grammar, symbol, TERM_NON_TERMINAL_TYPE, 0);
+  lalr_rule(&grammar, 0, &x, 1, NULL);
+  for (n = 1; n < lalr->nonterminals && lalr->supported; n++)
+    lalr_rules(&grammar, n);
+  T = lalr->terminals;
+  N = lalr->nonterminals;
+  width = grammar.width = (T + 1 + 7) / 8 + 1;
+  if (lalr->supported && width > PARSE_FIRST_SIZE * 8)
+    lalr->supported = FALSE;
+  if (!lalr->supported)
+    goto done;
+  lalr_first(&grammar);
+  lalr_items(&grammar);
+  item = (int *) malloc(grammar.items * sizeof(int));
+  mark = (int *) calloc(grammar.items, sizeof(int));
+  
+  /* LR(0) collection; states are sorted kernel item sets */
+  kernel = (int *) lalr_grow(kernel, &kernel_size, 1, sizeof(int));
+  kernel[kernels++] = 0;
+  state = (int *) lalr_grow(state, &state_size, 2, sizeof(int));
+  state[0] = 0;
+  state[1] = 1;
+  lalr->states = 1;
+  for (s = 0; s < lalr->states; s++) {
+    count = state[s * 2 + 1];
+    memcpy(item, kernel + state[s * 2], count * sizeof(int));
+    count = lalr_closure(&grammar, item, count, NULL, mark, ++stamp);
+    for (i = 0; i < count; i++) {
+      if (item[i] < 0 || grammar.item_next[item[i]] == LALR_END)
+	continue;
+      x = grammar.item_next[item[i]];
+
+      /* Goto kernel on x; the advanced items in item order */
+      k = kernels;
+      for (j = i; j < count; j++)
+	if (item[j] >= 0 && grammar.item_next[item[j]] == x) {
+	  kernel = (int *) lalr_grow(kernel, &kernel_size, kernels, sizeof(int));
+	  for (n = kernels; n > k && kernel[n - 1] > item[j] + 1; n--)
+	    kernel[n] = kernel[n - 1];
+	  kernel[n] = item[j] + 1;
+	  kernels++;
+	  if (j > i) 
+	    item[j] = -1;
+	}
+      for (t = 0; t < lalr->states; t++)
+	if (state[t * 2 + 1] == kernels - k &&
+	    !memcmp(kernel + state[t * 2], kernel + k, (kernels - k) * sizeof(int)))
+	  break;
+      if (t == lalr->states) {
+	state = (int *) lalr_grow(state, &state_size, t * 2 + 2, sizeof(int));
+	state[t * 2] = k;
+	state[t * 2 + 1] = kernels - k;
+	lalr->states++;
+      }
+      else
+	kernels = k;
+      edge = (int *) lalr_grow(edge, &edge_size, edges * 3 + 3, sizeof(int));
+      edge[edges * 3] = s;
+      edge[edges * 3 + 1] = x;
+      edge[edges * 3 + 2] = t;
+      edges++;
+    }
+  }
+
+  /* Action and goto tables with shift entries */
+  lalr->action = (int *) calloc(lalr->states * (T + 1), sizeof(int));
+  lalr->go = (int *) calloc(lalr->states * N, sizeof(int));
+  for (i = 0; i < edges; i++) {
+    s = edge[i * 3];
+    x = edge[i * 3 + 1];
+    t = edge[i * 3 + 2];
+    if (LALR_TERMINAL(x))
+      lalr->action[s * (T + 1) + LALR_CODE(x)] = t + 1;
+    else
+      lalr->go[s * N + x] = t;
+  }
+  
+  /* Lookaheads; spontaneous generation and propagation with dummy */
+  la = (unsigned char *) calloc(kernels, width);
+  scratch = (unsigned char *) malloc(grammar.items * width);
+  LALR_BIT_SET(la, T);
+  for (s = 0; s < lalr->states; s++) {
+    for (k = state[s * 2]; k < state[s * 2] + state[s * 2 + 1]; k++) {
+      item[0] = kernel[k];
+      memset(scratch + item[0] * width, 0, width);
+      LALR_BIT_SET(scratch + item[0] * width, T + 1);
+      count = lalr_closure(&grammar, item, 1, scratch, mark, ++stamp);
+      for (i = 0; i < count; i++) {
+	x = grammar.item_next[item[i]];
+	if (x == LALR_END)
+	  continue;
+	if (LALR_TERMINAL(x))
+	  t = lalr->action[s * (T + 1) + LALR_CODE(x)] - 1;
+	else
+	  t = lalr->go[s * N + x];
+	for (j = state[t * 2]; kernel[j] != item[i] + 1; j++)
+	  ;
+	for (e = 0; e < width; e++)
+	  la[j * width + e] |= scratch[item[i] * width + e];
+	la[j * width + ((T + 1) >> 3)] &= ~(1 << ((T + 1) & 7));
+	if (LALR_BIT_HAS(scratch + item[i] * width, T + 1)) {
+	  prop = (int *) lalr_grow(prop, &prop_size, props * 2 + 2, sizeof(int));
+	  prop[props * 2] = k;
+	  prop[props * 2 + 1] = j;
+	  props++;
+	}
+      }
+    }
+  }
+  do {
+    changed = FALSE;
+    for (i = 0; i < props; i++)
+      for (e = 0; e < width; e++) {
+	x = la[prop[i * 2] * width + e];
+	if ((la[prop[i * 2 + 1] * width + e] | x) != la[prop[i * 2 + 1] * width + e]) {
+	  la[prop[i * 2 + 1] * width + e] |= x;
+	  changed = TRUE;
+	}
+      }
+  } while (changed);
+
+  /* Reduce entries; closure of the kernel with the final lookaheads */
+  lalr->expect = (SYMBOL **) calloc(lalr->states, sizeof(SYMBOL *));
+  for (s = 0; s < lalr->states; s++) {
+    count = state[s * 2 + 1];
+    for (i = 0; i < count; i++) {
+      item[i] = kernel[state[s * 2] + i];
+      memcpy(scratch + item[i] * width, la + (state[s * 2] + i) * width, width);
+    }
+    n = count;
+    count = lalr_closure(&grammar, item, count, scratch, mark, ++stamp);
+    for (i = 0; i < count; i++) {
+      x = grammar.item_next[item[i]];
+      if (x == LALR_END) {
+	for (t = 0; t <= T; t++)
+	  if (LALR_BIT_HAS(scratch + item[i] * width, t))
+	    lalr_action(lalr, s, t, -grammar.item_rule[item[i]] - 1);
+      }
+    }
+
+    /* Expected symbol; after the longest kernel prefix, else a terminal */
+    for (e = -1, i = 0; i < n; i++) {
+      x = grammar.item_next[item[i]];
+      j = item[i] - grammar.item_start[grammar.item_rule[item[i]]];
+      if (x != LALR_END && j > e) {
+	lalr->expect[s] = lalr_symbol(&grammar, x);
+	e = j;
+      }
+    }
+    for (t = 0; t < T && lalr->expect[s] == NULL; t++)
+      if (lalr->action[s * (T + 1) + t] != 0)
+	lalr->expect[s] = lalr->terminal[t].symbol;
+  }
+  free(la);
+  free(scratch);
+  free(item);
+  free(mark);
+
+ done:
+  free(kernel);
+  free(state);
+  free(edge);
+  free(prop);
+  free(grammar.symbol);
+  free(grammar.type);
+  free(grammar.element);
+  free(grammar.rhs);
+  free(grammar.start);
+  free(grammar.first);
+  free(grammar.nullable);
+  free(grammar.item_rule);
+  free(grammar.item_next);
+  free(grammar.item_start);
+}
+
+static void lalr_prepare(SYMBOL *symbol)
+{
+  LALR *lalr = symbol->lalr;
+
+  /* Tables are rebuilt by parse_prepare when the grammar has changed */
+  if (lalr != NULL) {
+    free(lalr->terminal);
+    free(lalr->lhs);
+    free(lalr->length);
+    free(lalr->semantic);
+    free(lalr->action);
+    free(lalr->go);
+    free(lalr->expect);
+  }
+  else
+    lalr = symbol->lalr = (LALR *) malloc(sizeof(LALR));
+  memset(lalr, 0, sizeof(LALR));
+  lalr_build(lalr, symbol);
+}
+
+int parse_conflicts(SYMBOL *symbol)
+{
+  LALR *lalr = symbol->lalr;
+  return (lalr != NULL && PREPARED(symbol) && lalr->supported ? lalr->conflicts : -1);
+}
+
+static int lalr_scan(PARSER *parser, TERM *term, char **input, VALUE **output)
+{
+  int ok;
+  
+  /* Literal strings are matched; other terminals are scanned */
+  if (term->type == TERM_TERMINAL_TYPE)
+    return (parse_symbol(parser, term->symbol, input, output));
+  ok = term->symbol->parse(parser, term->symbol, input, output);
+  parser->cutting = FALSE;
+  return (ok);
+}
+
+static int lalr_fallback(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  PRODUCT *product;
+
+  /* Back-tracking parser; direct left recursion by growing a seed */
+  for (product = symbol->syntax; product != NULL && *product != NULL; product++)
+    if ((*product)->type != TERM_TERMINAL_TYPE &&
+	(*product)->type != TERM_PRODUCT_END_TYPE &&
+	(*product)->symbol == symbol)
+      return (parse_left_recursive(parser, symbol, input, output));
+  return (parse_syntax(parser, symbol, input, output));
+}
+
+int parse_lalr(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE *old_output = *output;
+  char *old_input = *input;
+  LALR *lalr;
+  VALUE *sp;
+  char **match;
+  char *empty;
+  char *end;
+  char *ip;
+  int *stack;
+  int size;
+  int top;
+  int action;
+  int ok;
+  int s, t, i, r;
+  
+  /* Tracing and grammars with side effects use the back-tracking parser */
+  if (parse_tracing || symbol->syntax == NULL)
+    return (lalr_fallback(parser, symbol, input, output));
+  lalr = symbol->lalr;
+  if (lalr == NULL || !PREPARED(symbol) || !lalr->supported)
+    return (lalr_fallback(parser, symbol, input, output));
+
+  /* State stack on the heap; grows with the nesting of the input */
+  size = 64;
+  stack = (int *) malloc(size * sizeof(int));
+  stack[0] = 0;
+  top = 0;
+  empty = NULL;
+
+  /* Terminals are scanned at most once per input position */
+  match = (char **) malloc((lalr->terminals + 1) * sizeof(char *));
+  for (i = 0; i < lalr->terminals; i++)
+    match[i] = LALR_UNKNOWN;
+  for (;;) {
+    /* Lookahead is the longest terminal with an action in the state */
+    s = stack[top];
+    t = lalr->terminals;
+    end = NULL;
+    for (i = 0; i < lalr->terminals; i++) {
+      if (lalr->action[s * (lalr->terminals + 1) + i] == 0)
+	continue;
+      if (match[i] == LALR_UNKNOWN) {
+	ip = *input;
+	sp = *output;
+	match[i] = (lalr_scan(parser, &lalr->terminal[i], &ip, &sp) ? ip : NULL);
+      }
+      if (match[i] != NULL && (end == NULL || match[i] > end)) {
+	end = match[i];
+	t = i;
+      }
+    }
+    action = lalr->action[s * (lalr->terminals + 1) + t];
+    if (top + 1 == size) {
+      size *= 2;
+      stack = (int *) realloc(stack, size * sizeof(int));
+    }
+
+    /* Shift; scan again to generate code. Stop empty shift loops */
+    if (action > 0 && (end != *input || empty != end)) {
+      if (end == *input)
+	empty = end;
+      lalr_scan(parser, &lalr->terminal[t], input, output);
+      stack[++top] = action - 1;
+      for (i = 0; i < lalr->terminals; i++)
+	match[i] = LALR_UNKNOWN;
+    }
+
+    /* Reduce; bind rule semantics and goto. Rule zero accepts */
+    else if (action < 0) {
+      r = -action - 1;
+      if (r == 0) {
+	ok = TRUE;
+	break;
+      }
+      top -= lalr->length[r];
+      symbol_bind(lalr->semantic[r], output);
+      s = stack[top];
+      stack[++top] = lalr->go[s * lalr->nonterminals + lalr->lhs[r]];
+    }
+
+    /* Capture error position and expected symbol */
+    else {
+      ip = space_skip(parser, *input);
+      if (ip >= parser->error_input) {
+	parser->error_input = ip;
+	parser->error_symbol = (lalr->expect[s] ? lalr->expect[s] : symbol);
+      }
+      *input = old_input;
+      *output = old_output;
+      ok = FALSE;
+      break;
+    }
+  }
+  free(match);
+  free(stack);
+  return (ok);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Grammar virtual machine (compiled products, threaded code)
+ * ----------------------------------------------------------------------
+ */
+
+/* Instructions; operands follow the operation code */
+typedef enum {
+  VM_ENTER,			/* symbol: push frame and select products */
+  VM_ALT,			/* index, next, product: try product */
+  VM_MATCH,			/* symbol: match terminal string */
+  VM_CALL,			/* entry: call compiled symbol */
+  VM_PARSE,			/* symbol: call parse function */
+  VM_COMMIT,			/* cut; no back-tracking to next product */
+  VM_OPTIONAL,			/* zero or one; always true */
+  VM_STAR,			/* loop: repeat while true */
+  VM_PLUS,			/* skip: skip repeat if false */
+  VM_PEEK,			/* type, symbol: lookahead; back-track if false */
+  VM_CHECK,			/* symbol: capture error, back-track if false */
+  VM_EMIT,			/* semantic: bind and return true */
+  VM_FAIL			/* return false */
+} VM_OP;
+
+typedef union {
+  int op;
+  int n;
+  SYMBOL *symbol;
+  TERM *term;
+} VM_CODE;
+
+/* Frame per active symbol; heap allocated in the parse context */
+struct FRAME {
+  int ret;
+  int alt;
+  int cutting;
+  unsigned long select;
+  char *ip;
+  char *input;
+  VALUE *output;
+};
+
+/* Code of a symbol and the symbols it calls; built by parse_prepare
+   and only read by a parse. The entry of the symbol is at zero */
+struct VM {
+  int analysis;
+  VM_CODE *code;
+  int count;
+  int size;
+};
+
+/* Symbols being compiled and their entries; calls are patched when
+   all symbols have been compiled */
+typedef struct {
+  VM *vm;
+  SYMBOL **symbol;
+  int *entry;
+  int symbols;
+  int compiled;
+  int *fixup;
+  int fixups;
+} VM_COMPILE;
+
+static int vm_emit(VM *vm, int op)
+{
+  /* Append an instruction word and return its position */
+  if (vm->count == vm->size) {
+    vm->size = (vm->size == 0 ? 1024 : vm->size * 2);
+    vm->code = (VM_CODE *) realloc(vm->code, vm->size * sizeof(VM_CODE));
+  }
+  vm->code[vm->count].op = op;
+  return (vm->count++);
+}
+
+static void vm_operand(VM *vm, SYMBOL *symbol)
+{
+  vm->code[vm_emit(vm, 0)].symbol = symbol;
+}
+
+static void vm_call(VM_COMPILE *cc, SYMBOL *symbol)
+{
+  VM *vm = cc->vm;
+  int i;
+  
+  /* Cut, compiled symbols and other parse functions. Predictive symbols
+   * are compiled; product selection gives the same single product */
+  if (symbol->parse == parse_cut) {
+    vm_emit(vm, VM_COMMIT);
+    return;
+  }
+  if (symbol->syntax == NULL ||
+      (symbol->parse != parse_syntax && symbol->parse != parse_predict) ||
+      operator_symbol(symbol)) {
+    vm_emit(vm, VM_PARSE);
+    vm_operand(vm, symbol);
+    return;
+  }
+  vm_emit(vm, VM_CALL);
+  
+  /* Compile the symbol later if it is new and patch the entry */
+  for (i = 0; i < cc->symbols && cc->symbol[i] != symbol; i++);
+  if (i == cc->symbols) {
+    cc->symbol = (SYMBOL **) realloc(cc->symbol, (i + 1) * sizeof(SYMBOL *));
+    cc->entry = (int *) realloc(cc->entry, (i + 1) * sizeof(int));
+    cc->symbol[i] = symbol;
+    cc->entry[i] = -1;
+    cc->symbols++;
+  }
+  cc->fixup = (int *) realloc(cc->fixup, (cc->fixups + 1) * sizeof(int));
+  cc->fixup[cc->fixups++] = vm_emit(vm, 0);
+  vm->code[cc->fixup[cc->fixups - 1]].n = i;
+}
+
+static VM *vm_compile(SYMBOL *root)
+{
+  VM_COMPILE cc;
+  VM *vm;
+  SYMBOL *symbol;
+  PRODUCT *product;
+  TERM *term;
+  int alt, loop, skip;
+  int i, n;
+  
+  /* Compile the symbol and the symbols it calls */
+  vm = (VM *) calloc(1, sizeof(VM));
+  cc.vm = vm;
+  cc.symbol = (SYMBOL **) malloc(sizeof(SYMBOL *));
+  cc.entry = (int *) malloc(sizeof(int));
+  cc.symbol[0] = root;
+  cc.symbols = 1;
+  cc.fixup = NULL;
+  cc.fixups = 0;
+  for (cc.compiled = 0; cc.compiled < cc.symbols; cc.compiled++) {
+    symbol = cc.symbol[cc.compiled];
+    cc.entry[cc.compiled] = vm_emit(vm, VM_ENTER);
+    vm_operand(vm, symbol);
+    for (n = 0; symbol->syntax[n] != NULL; n++) {
+      i = PRODUCT_ORDER(symbol, n);
+      product = symbol->syntax + i;
+      alt = vm_emit(vm, VM_ALT);
+      vm->code[vm_emit(vm, 0)].n = i;
+      vm_emit(vm, 0);
+      vm->code[vm_emit(vm, 0)].term = *product;
+      for (term = *product; term->type != TERM_PRODUCT_END_TYPE; term++) {
+	switch (term->type) {
+	case TERM_TERMINAL_TYPE:
+	  vm_emit(vm, VM_MATCH);
+	  vm_operand(vm, term->symbol);
+	  break;
+	case TERM_NON_TERMINAL_TYPE:
+	  if (term->symbol->parse == NULL) {
+	    vm_emit(vm, VM_FAIL);
+	    continue;
+	  }
+	  vm_call(&cc, term->symbol);
+	  break;
+	case TERM_ZERO_OR_ONE_TYPE:
+	  if (term->symbol->parse != NULL)
+	    vm_call(&cc, term->symbol);
+	  vm_emit(vm, VM_OPTIONAL);
+	  break;
+	case TERM_ZERO_OR_MANY_TYPE:
+	  if (term->symbol->parse == NULL) {
+	    vm_emit(vm, VM_FAIL);
+	    continue;
+	  }
+	  loop = vm->count;
+	  vm_call(&cc, term->symbol);
+	  vm_emit(vm, VM_STAR);
+	  vm->code[vm_emit(vm, 0)].n = loop;
+	  break;
+	case TERM_ONE_OR_MANY_TYPE:
+	  if (term->symbol->parse == NULL) {
+	    vm_emit(vm, VM_FAIL);
+	    continue;
+	  }
+	  vm_call(&cc, term->symbol);
+	  vm_emit(vm, VM_PLUS);
+	  skip = vm_emit(vm, 0);
+	  loop = vm->count;
+	  vm_call(&cc, term->symbol);
+	  vm_emit(vm, VM_STAR);
+	  vm->code[vm_emit(vm, 0)].n = loop;
+	  vm->code[skip].n = vm->count;
+	  break;
+	case TERM_AND_PREDICATE_TYPE:
+	case TERM_NOT_PREDICATE_TYPE:
+	  vm_emit(vm, VM_PEEK);
+	  vm->code[vm_emit(vm, 0)].n = term->type;
+	  vm_operand(vm, term->symbol);
+	  continue;
+	case TERM_LEFT_OPERATOR_TYPE:
+	case TERM_RIGHT_OPERATOR_TYPE:
+	  /* Symbols with operator tables are not compiled */
+	  vm_emit(vm, VM_FAIL);
+	  continue;
+	case TERM_PRODUCT_END_TYPE:
+	  break;
+	}
+	vm_emit(vm, VM_CHECK);
+	vm_operand(vm, TERM_ERROR(term));
+	if (term - *product + 1 == PRODUCT_COMMIT(symbol, i)) {
+	  vm_emit(vm, VM_COMMIT);
+	  vm_emit(vm, VM_CHECK);
+	  vm_operand(vm, TERM_ERROR(term));
+	}
+      }
+      vm_emit(vm, VM_EMIT);
+      vm_operand(vm, term->symbol);
+      vm->code[alt + 2].n = vm->count;
+    }
+    vm_emit(vm, VM_FAIL);
+  }
+
+  /* Patch calls with the entries of the compiled symbols */
+  for (i = 0; i < cc.fixups; i++)
+    vm->code[cc.fixup[i]].n = cc.entry[vm->code[cc.fixup[i]].n];
+  free(cc.symbol);
+  free(cc.entry);
+  free(cc.fixup);
+  return (vm);
+}
+
+static void vm_free(VM *vm)
+{
+  if (vm != NULL) {
+    free(vm->code);
+    free(vm);
+  }
+}
+
+static void vm_prepare(SYMBOL *symbol, int analysis)
+{
+  /* Plain syntax runs on the virtual machine */
+  if (symbol->vm != NULL && symbol->vm->analysis >= analysis)
+    return;
+  vm_free(symbol->vm);
+  symbol->vm = NULL;
+  if (symbol->syntax != NULL &&
+      (symbol->parse == parse_syntax || symbol->parse == parse_predict) &&
+      !operator_symbol(symbol)) {
+    symbol->vm = vm_compile(symbol);
+    symbol->vm->analysis = analysis;
+  }
+}
+
+static int vm_run(PARSER *parser, VM *vm, char **input, VALUE **output)
+{
+#if defined(__GNUC__)
+  static void *label[] = {
+    &&op_enter, &&op_alt, &&op_match, &&op_call, &&op_parse, &&op_commit,
+    &&op_optional, &&op_star, &&op_plus, &&op_peek, &&op_check, &&op_emit,
+    &&op_fail
+  };
+#define VM_NEXT() goto *label[pc->op]
+#else
+#define VM_NEXT() goto vm_dispatch
+#endif
+  VM_CODE *code = vm->code;
+  FRAME *fp;
+  VM_CODE *pc;
+  SYMBOL *symbol;
+  char *ip;
+  int base;
+  int top;
+  int ret;
+  int ok;
+  int n;
+
+  /* Threaded code; labels as values with GCC, otherwise a switch */
+  if (parser->frame == NULL) {
+    parser->frame_size = (parse_depth > 0 && parse_depth < 64 ? parse_depth : 64);
+    parser->frame = (FRAME *) malloc(parser->frame_size * sizeof(FRAME));
+  }
+  base = parser->frames;
+  fp = parser->frame + base - 1;
+  pc = code;
+  ret = -1;
+  ok = FALSE;
+  VM_NEXT();
+#if !defined(__GNUC__)
+ vm_dispatch:
+  switch (pc->op) {
+  case VM_ENTER: goto op_enter;
+  case VM_ALT: goto op_alt;
+  case VM_MATCH: goto op_match;
+  case VM_CALL: goto op_call;
+  case VM_PARSE: goto op_parse;
+  case VM_COMMIT: goto op_commit;
+  case VM_OPTIONAL: goto op_optional;
+  case VM_STAR: goto op_star;
+  case VM_PLUS: goto op_plus;
+  case VM_PEEK: goto op_peek;
+  case VM_CHECK: goto op_check;
+  case VM_EMIT: goto op_emit;
+  default: goto op_fail;
+  }
+#endif
+
+ op_enter:
+  /* Push frame; the stack grows until the maximum depth is reached */
+  if (fp + 1 == parser->frame + parser->frame_size) {
+    n = fp - parser->frame;
+    if (parse_depth > 0 && n + 1 >= parse_depth) {
+      parser->error_input = *input;
+      parser->error_symbol = pc[1].symbol;
+      parser->overflow = TRUE;
+      ok = FALSE;
+      goto op_exit;
+    }
+    parser->frame_size = parser->frame_size * 2;
+    if (parse_depth > 0 && parser->frame_size > parse_depth)
+      parser->frame_size = parse_depth;
+    parser->frame = (FRAME *) realloc(parser->frame, parser->frame_size * sizeof(FRAME));
+    fp = parser->frame + n;
+  }
+  fp++;
+
+  /* Select the products that may start with the next byte */
+  fp->ret = ret;
+  fp->cutting = FALSE;
+  fp->select = ~0UL;
+  symbol = pc[1].symbol;
+  ip = *input;
+  if (PREPARED(symbol) && symbol->select != NULL) {
+    ip = space_skip(parser, ip);
+    fp->select = symbol->select[INPUT_BYTE(parser, ip)];
+    if (TRIE_ACTIVE(symbol))
+      fp->select &= trie_select(parser, symbol->trie, ip);
+  }
+  fp->ip = ip;
+  pc += 2;
+  VM_NEXT();
+
+ op_alt:
+  /* Try product if selected; save back-track point */
+  n = pc[1].n;
+  if (n < SELECT_MAX && (fp->select & (1UL << n)) == 0) {
+    select_reject(parser, pc[3].term, fp->ip);
+    pc = code + pc[2].n;
+    VM_NEXT();
+  }
+  fp->input = *input;
+  fp->output = *output;
+  fp->alt = pc[2].n;
+  pc += 4;
+  VM_NEXT();
+
+ op_match:
+  ok = parse_symbol(parser, pc[1].symbol, input, output);
+  pc += 2;
+  VM_NEXT();
+
+ op_call:
+  ret = pc - code + 2;
+  pc = code + pc[1].n;
+  VM_NEXT();
+
+ op_parse:
+  /* The parse function may grow the stack; use positions */
+  n = pc - code + 2;
+  top = fp - parser->frame;
+  parser->frames = top + 1;
+  symbol = pc[1].symbol;
+  ok = symbol->parse(parser, symbol, input, output);
+  fp = parser->frame + top;
+  pc = code + n;
+  if (parser->overflow) {
+    ok = FALSE;
+    goto op_exit;
+  }
+  VM_NEXT();
+
+ op_commit:
+  parser->cutting = TRUE;
+  ok = TRUE;
+  pc++;
+  VM_NEXT();
+
+ op_optional:
+  ok = TRUE;
+  pc++;
+  VM_NEXT();
+
+ op_star:
+  if (ok)
+    pc = code + pc[1].n;
+  else {
+    ok = TRUE;
+    pc += 2;
+  }
+  VM_NEXT();
+
+ op_plus:
+  if (!ok)
+    pc = code + pc[1].n;
+  else
+    pc += 2;
+  VM_NEXT();
+
+ op_peek:
+  /* Lookahead from the position; input and output are not changed */
+  n = pc - code + 3;
+  top = fp - parser->frame;
+  parser->frames = top + 1;
+  ok = parse_lookahead(parser, (TERM_TYPE) pc[1].n, pc[2].symbol, *input, *output);
+  fp = parser->frame + top;
+  pc = code + n;
+  if (parser->overflow) {
+    ok = FALSE;
+    goto op_exit;
+  }
+  if (ok)
+    VM_NEXT();
+  goto op_back;
+
+ op_check:
+  /* Check for cut and capture error position */
+  if (parser->cutting) {
+    parser->cutting = FALSE;
+    fp->cutting = TRUE;
+    parse_evict(parser, *input);
+  }
+  if (*input >= parser->error_input && pc[1].symbol->origin == NULL) {
+    parser->error_input = *input;
+    parser->error_symbol = pc[1].symbol;
+  }
+  if (ok) {
+    pc += 2;
+    VM_NEXT();
+  }
+
+  /* Back-track and try next product unless cut */
+ op_back:
+  *input = fp->input;
+  *output = fp->output;
+  if (!fp->cutting) {
+    pc = code + fp->alt;
+    VM_NEXT();
+  }
+  goto op_fail;
+
+ op_emit:
+  symbol_bind(pc[1].symbol, output);
+  ok = TRUE;
+  goto op_return;
+
+ op_fail:
+  ok = FALSE;
+
+ op_return:
+  /* Pop frame and return to caller */
+  n = fp->ret;
+  fp--;
+  if (n >= 0) {
+    pc = code + n;
+    VM_NEXT();
+  }
+
+ op_exit:
+  parser->frames = base;
+  return (ok);
+}
+
+int parse_vm(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  /* Tracing and symbols without code use the parse function */
+  if (parse_tracing || symbol->vm == NULL || !PREPARED(symbol))
+    return (parse_syntax(parser, symbol, input, output));
+  return (vm_run(parser, symbol->vm, input, output));
+}
+
+int parse_undefined(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  printf("<%s> undefined\n", symbol->name);
+  parser->warning = TRUE;
+  return (FALSE);
+}
+
+int parse_empty(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  return (TRUE);
+}
+
+int parse_eoln(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  /* Parse white space; the end of a stream may not be reached yet */
+  parse_space(parser, symbol, input, output);
+  if (!INPUT_END(parser, *input))
+    return (FALSE);
+  parser->input_short = TRUE;
+  return (TRUE);
+}
+
+int parse_integer(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *endptr;
+  int range;
+  int ok;
+
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, &symbol_integer, input, output)) >= 0)
+    return (ok);
+
+  /* Scan for an integer value in input */
+  parse_space(parser, symbol, input, output);
+  endptr = number_integer(parser, *input, &v, &range);
+
+  /* If not found or out of range reject parse */
+  if (endptr == NULL) 
+    return (FALSE);
+  if (range)
+    return (number_range(parser, &symbol_integer, *input));
+
+  /* Bind value for semantic function */
+  *input = endptr;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+int parse_float(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *endptr;
+  int range;
+  int ok;
+
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, &symbol_float, input, output)) >= 0)
+    return (ok);
+
+  /* Scan for a floating point value; digits with fraction or exponent */
+  parse_space(parser, symbol, input, output);
+  endptr = number_float(parser, *input, &v, &range);
+
+  /* If not found or out of range reject parse */
+  if (endptr == NULL) 
+    return (FALSE);
+  if (range)
+    return (number_range(parser, &symbol_float, *input));
+
+  /* Bind value for semantic function */
+  *input = endptr;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+int parse_string(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *ip;
+  char *tp;
+  char end;
+  char c;
+  int n;
+  int ok;
+
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, &symbol_string, input, output)) >= 0)
+    return (ok);
+
+  /* Check start character */
+  parse_space(parser, symbol, input, output);
+  ip = *input;
+  c = INPUT_BYTE(parser, ip);
+  ip++;
+  if (c != '"' && c != '\'')
+    return (FALSE);
+
+  /* Scan the string to the end quote; an escape skips the next
+     character. No modification! */
+  end = c;
+  tp = ip;
+  while (!INPUT_SHORT(parser, ip = scan_string(ip, parser->input_end, end), *input) &&
+	 *ip == '\\') {
+    ip++;
+    if (!INPUT_SHORT(parser, ip, *input))
+      ip++;
+  }
+
+  /* What out for end of string */
+  if (INPUT_SHORT(parser, ip, *input))
+    return (FALSE);
+
+  n = ip - tp;
+  *input = ip + 1;
+
+  /* Bind unprocessed string value for semantic function */
+  v.type = VALUE_STRING_TYPE;
+  v.view.as_string.count = n;
+  v.view.as_string.buffer = tp;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+int parse_identifier(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *ip = *input;
+  char *tp;
+  char c;
+  int n;
+  int ok;
+
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, &symbol_identifier, input, output)) >= 0)
+    return (ok);
+
+  /* Check for an alpha character or underscore */
+  parse_space(parser, symbol, input, output);
+  ip = *input;
+  c = INPUT_BYTE(parser, ip);
+  ip++;
+  if (!isalpha(c) && (c != '_'))
+    return (FALSE);
+
+  /* Scan identifier: alpha, number or underscore sequence. It may
+     continue in the next chunk if it reaches the end of input */
+  tp = ip - 1;
+  ip = scan_identifier(ip, parser->input_end);
+  (void) INPUT_SHORT(parser, ip, tp);
+  n = ip - tp;
+  *input = ip;
+  
+  /* Bind value for semantic function */
+  v.type = VALUE_STRING_TYPE;
+  v.view.as_string.count = n;
+  v.view.as_string.buffer = tp;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+int parse_regex(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *ip;
+
+  /* Scan a regular expression literal; /.../ without white space */
+  parse_space(parser, symbol, input, output);
+  ip = *input;
+  if (INPUT_BYTE(parser, ip) != '/' || INPUT_NEXT(parser, ip + 1, *input) == '/')
+    return (FALSE);
+  for (ip++; INPUT_NEXT(parser, ip, *input) != '/'; ip++) {
+    if (*ip == '\\' && INPUT_NEXT(parser, ip + 1, *input) > ' ')
+      ip++;
+    if (INPUT_NEXT(parser, ip, *input) <= ' ')
+      return (FALSE);
+  }
+  ip++;
+  if (INPUT_NEXT(parser, ip, *input) > ' ')
+    return (FALSE);
+
+  /* Bind the literal with the slashes for semantic function */
+  v.type = VALUE_STRING_TYPE;
+  v.view.as_string.count = ip - *input;
+  v.view.as_string.buffer = *input;
+  value_bind(&v, output);
+  *input = ip;
+
+  return (TRUE);
+}
+
+int parse_dfa(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  DFA *dfa = symbol->dfa;
+  VALUE v;
+  char *ip;
+  char *end;
+  int s;
+  int ok;
+
+  /* Use the tokens of the lexer stage if enabled */
+  if (parser->lexer != NULL && (ok = lexer_match(parser, symbol, input, output)) >= 0)
+    return (ok);
+
+  /* Run the transition table and remember the longest match */
+  parse_space(parser, symbol, input, output);
+  ip = *input;
+  end = (dfa->accept[0] ? ip : NULL);
+  for (s = 0; !INPUT_SHORT(parser, ip, *input); ) {
+    s = dfa->next[s * dfa->classes + dfa->map[(unsigned char) *ip]];
+    if (s < 0)
+      break;
+    ip++;
+    if (dfa->accept[s])
+      end = ip;
+  }
+  if (end == NULL)
     return (FALSE);
 
+  /* Bind the matched string for semantic function */
+  v.type = VALUE_STRING_TYPE;
+  v.view.as_string.count = end - *input;
+  v.view.as_string.buffer = *input;
+  value_bind(&v, output);
+  *input = end;
+
+  return (TRUE);
+}
+
+int parse_token(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  char *ip;
+  char *tp;
+  char c;
+  int n;
+  
+  /* Check that there was something left */
+  parse_space(parser, symbol, input, output);
+  ip = *input;
+  c = INPUT_BYTE(parser, ip);
+  ip++;
+  if (c == 0)
+    return (FALSE);
+
+  /* Scan anything until white space, or the end of input */
+  tp = ip - 1;
+  ip = scan_token(ip, parser->input_end);
+  (void) INPUT_SHORT(parser, ip, tp);
+  n = ip - tp;
+  *input = ip;
+
+  /* Bind value for semantic function */
+  v.type = VALUE_STRING_TYPE;
+  v.view.as_string.count = n;
+  v.view.as_string.buffer = tp;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+int parse_nospace(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  return (INPUT_END(parser, *input) || **input > ' ');
+}
+
+int parse_space(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  char *ip = space_skip(parser, *input);
+
+  /* Skip space; the end of a run is looked up after the first scan */
+  if (ip == *input)
+    return (FALSE);
+  *input = ip;
+  
+  return (TRUE);
+}
+
+int parse_throw(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  longjmp(parser->catch_buf, 1);
+  return (FALSE);
+}
+
+int parse_cut(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  parser->cutting = TRUE;
+  return (TRUE);
+}
+
+int parse_run(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  ENVIRONMENT env;
+  VALUE stack[64];
+
+  /* The output is rewound. Memoized code may no longer be replayed */
+  memo_clear(parser);
+  (*output)->type = VALUE_UNDEFINED_TYPE;
+  env.sp = stack;
+  env.ip = parser->start_output;
+  parse_execute(&env);
+  *output = parser->start_output;
+  return (!env.executing);
+}
+
+int parse_pos(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  VALUE v;
+  
+  /* Bind current position for semantic function */
+  v.type = VALUE_STR_TYPE;
+  v.view.as_str = *input;
+  value_bind(&v, output);
+
+  return (TRUE);
+}
+
+static int parse_bounded(PARSER *parser, SYMBOL *symbol, char **input, char *end, VALUE **output)
+{
+  clock_t start;
+  int ok;
+  
   /* Are we doing timing? */
   if (parse_timing)
     start = clock();
 
   /* Setup error capture environment */
-  start_input = parse_error_input = *input;
-  start_output = *output;
-  parse_error_symbol = symbol;
-  parse_indent = 0;
-  parse_warning = FALSE;
+  parser->start_input = parser->error_input = *input;
+  parser->input_end = end;
+  parser->input_short = FALSE;
+  parser->start_output = *output;
+  parser->error_symbol = symbol;
+  parser->indent = 0;
+  parser->cutting = FALSE;
+  parser->warning = FALSE;
+  parser->overflow = FALSE;
+  parser->frame = NULL;
+  parser->frame_size = 0;
+  parser->frames = 0;
+  parser->keyword_input = NULL;
+  parser->keywords = (PREPARED(symbol) ? symbol->keywords : NULL);
+  parser->range_input = NULL;
+  memset(parser->space_input, 0, sizeof(parser->space_input));
+  memset(parser->memo, 0, sizeof(parser->memo));
+  parser->memo_oldest = NULL;
+  parser->memo_newest = NULL;
+  parser->memo_low = NULL;
+  parser->memo_count = 0;
+  lexer_start(parser, symbol, *input);
   
   /* Capture parse error mark */
-  if (setjmp(parse_catch_buf) == 0) {
+  if (setjmp(parser->catch_buf) == 0) {
     
-    /* Parse the input string */
-    if (symbol->parse == NULL)
-      ok = parse_syntax(symbol, input, output);
+    /* Parse the input string; plain syntax runs on the virtual machine */
+    if (symbol->parse == NULL || symbol->parse == parse_syntax ||
+	symbol->parse == parse_predict)
+      ok = parse_vm(parser, symbol, input, output);
     else
-      ok = symbol->parse(symbol, input, output);
+      ok = symbol->parse(parser, symbol, input, output);
   } else {
     ok = FALSE;
   }
   
+  /* Memoized results are only valid for this input */
+  memo_clear(parser);
+  lexer_stop(parser);
+  free(parser->frame);
+  parser->frame = NULL;
+
   /* Timing? when display the result */
   if (parse_timing)
     printf("parse_input: %ld ms\n", ((clock() - start) * 1000)/CLK_TCK);
@@ -676,6 +4719,170 @@ int parse_input(SYMBOL *symbol, char **input, VALUE **output)
   return (TRUE);
 }
 
+int parse_input(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output)
+{
+  /* Watch out for rookie programmers */
+  if (parser == NULL || symbol == NULL || input == NULL || *input == NULL || output == NULL)
+    return (FALSE);
+
+  /* The input ends with a null character */
+  return (parse_bounded(parser, symbol, input, *input + strlen(*input), output));
+}
+
+int parse_span(PARSER *parser, SYMBOL *symbol, char *begin, char *end, VALUE **output)
+{
+  char *input = begin;
+  
+  /* Watch out for rookie programmers */
+  if (parser == NULL || symbol == NULL || begin == NULL || end < begin || output == NULL)
+    return (-1);
+
+  /* The input is parsed in place; no terminating null is needed */
+  if (!parse_bounded(parser, symbol, &input, end, output))
+    return (-1);
+  return (input - begin);
+}
+
+/* 
+ * ----------------------------------------------------------------------
+ * Section: Streaming input (records parsed from pushed chunks)
+ * ----------------------------------------------------------------------
+ */
+
+void parse_stream_open(STREAM *stream, SYMBOL *symbol)
+{
+  stream->symbol = symbol;
+  stream->buffer = NULL;
+  stream->size = 0;
+  stream->start = 0;
+  stream->count = 0;
+  stream->scan = 0;
+  stream->limit = PARSE_STREAM_MAX;
+  stream->lines = FALSE;
+  stream->skip = FALSE;
+  stream->end = FALSE;
+}
+
+void parse_stream_lines(STREAM *stream)
+{
+  stream->lines = TRUE;
+}
+
+void parse_stream_end(STREAM *stream)
+{
+  stream->end = TRUE;
+}
+
+void parse_stream_close(STREAM *stream)
+{
+  free(stream->buffer);
+  parse_stream_open(stream, stream->symbol);
+}
+
+static int stream_limit(PARSER *parser, STREAM *stream, char *end)
+{
+  /* Report a record that does not end within the limit at its start */
+  if (end - (stream->buffer + stream->start) < stream->limit)
+    return (FALSE);
+  parser->start_input = stream->buffer + stream->start;
+  parser->input_end = end;
+  parser->error_input = parser->start_input;
+  parser->error_symbol = stream->symbol;
+  parser->range_input = NULL;
+  parser->overflow = FALSE;
+  return (TRUE);
+}
+
+int parse_push(PARSER *parser, STREAM *stream, char *chunk, int length, VALUE **output)
+{
+  VALUE *start_output = *output;
+  char *line;
+  char *end;
+  char *ip;
+  int n;
+
+  /* Append the chunk; the input of the parsed records is dropped */
+  if (length > 0) {
+    if (stream->start > 0) {
+      stream->count -= stream->start;
+      stream->scan -= stream->start;
+      memmove(stream->buffer, stream->buffer + stream->start, stream->count);
+      stream->start = 0;
+    }
+    if (stream->count + length > stream->size) {
+      while (stream->count + length > stream->size)
+	stream->size = (stream->size == 0 ? 1024 : stream->size * 2);
+      ip = (char *) realloc(stream->buffer, stream->size);
+      if (ip == NULL)
+	return (PARSE_ERROR);
+      stream->buffer = ip;
+    }
+    memcpy(stream->buffer + stream->count, chunk, length);
+    stream->count += length;
+  }
+
+  /* A line stream parses each complete line once; only the new input
+     is searched for the end of the line. Lines with white space only
+     are skipped, a line that fails is dropped and so is the rest of a
+     line longer than the limit */
+  if (stream->lines) {
+    for (;;) {
+      end = stream->buffer + stream->count;
+      if (stream->scan < stream->start)
+	stream->scan = stream->start;
+      line = stream->buffer + stream->start;
+      ip = stream->buffer + stream->scan;
+      ip = (ip < end ? (char *) memchr(ip, '\n', end - ip) : NULL);
+      if (ip == NULL && !stream->end) {
+	stream->scan = stream->count;
+	if (stream->skip)
+	  stream->start = stream->count;
+	else if (stream_limit(parser, stream, end)) {
+	  stream->start = stream->count;
+	  stream->skip = TRUE;
+	  return (PARSE_ERROR);
+	}
+	return (PARSE_NEED_MORE);
+      }
+      if (ip == NULL)
+	ip = end;
+      stream->start = ip - stream->buffer + (ip < end);
+      stream->scan = stream->start;
+      for (end = line; end < ip && *end <= ' '; end++);
+      if (end < ip && !stream->skip)
+	break;
+      stream->skip = FALSE;
+      if (ip == stream->buffer + stream->count)
+	return (stream->end ? PARSE_END : PARSE_NEED_MORE);
+    }
+    if (parse_span(parser, stream->symbol, line, ip, output) < 0)
+      return (PARSE_ERROR);
+    return (PARSE_DONE);
+  }
+
+  /* Wait for more than white space; only space is left at the end */
+  end = stream->buffer + stream->count;
+  for (ip = stream->buffer + stream->start; ip < end && *ip <= ' '; ip++);
+  if (ip == end)
+    return (stream->end ? PARSE_END : PARSE_NEED_MORE);
+
+  /* Parse a record from the start. A match that ran into the end of
+     the buffered input, or a parse that failed there, is done again
+     when the next chunk is pushed, unless the record is at the limit */
+  n = parse_span(parser, stream->symbol, stream->buffer + stream->start,
+		 end, output);
+  if (n < 0)
+    for (ip = parser->error_input; ip < end && *ip <= ' '; ip++);
+  if (!stream->end && (parser->input_short || (n < 0 && ip == end))) {
+    *output = start_output;
+    return (stream_limit(parser, stream, end) ? PARSE_ERROR : PARSE_NEED_MORE);
+  }
+  if (n <= 0)
+    return (PARSE_ERROR);
+  stream->start += n;
+  return (PARSE_DONE);
+}
+
 /* 
  * ----------------------------------------------------------------------
  * Section: Generic grammar elements:
@@ -687,6 +4894,7 @@ int parse_input(SYMBOL *symbol, char **input, VALUE **output)
  *  <string>      True if a string literal is next. Binds string value.
  *  <token>       True if a token is next. Binds string value.
  *  <identifier>  True if an identifier is next. Binds string value.
+ *  <regex>       True if a /regular expression/ is next. Binds string.
  *  <space>       True if white space is next.
  *  <nospace>     True if next is not white space.
  *  <error>       True always and terminates parse.
@@ -723,8 +4931,12 @@ SYMBOL symbol_identifier = {
   &symbol_token, "identifier", 0, NULL, parse_identifier, NULL
 };
 
+SYMBOL symbol_regex = {
+  &symbol_identifier, "regex", 0, NULL, parse_regex, NULL
+};
+
 SYMBOL symbol_nospace = {
-  &symbol_identifier, "nospace", 0, NULL, parse_nospace, NULL
+  &symbol_regex, "nospace", 0, NULL, parse_nospace, NULL
 };
 
 SYMBOL symbol_space = {
@@ -923,20 +5135,24 @@ int main(int argc, char **argv)
   FILE *inf = NULL;
   char source[512];
   char *input;
+  PARSER parser;
   ENVIRONMENT env;
   VALUE code[128];
   VALUE *output;
   VALUE stack[64];
   VALUE *sp;
   int compile;
+  int functions;
   int arg;
   
+  compile = functions = FALSE;
   if (argc > 1) {
     if (!strcmp(argv[1], "-h")) {
-      printf("usage: parse [-c] [file...]\n");
+      printf("usage: parse [-c|-f] [file...]\n");
       return (1);
     }
-    if (!strcmp(argv[1], "-c")) {
+    functions = !strcmp(argv[1], "-f");
+    if (!strcmp(argv[1], "-c") || functions) {
       compile = TRUE;
       arg = 2;
     } else {
@@ -975,7 +5191,10 @@ int main(int argc, char **argv)
       if (inf == NULL) {
 	inf = stdin;
 	if (compile) {
-	  bnf_compile();
+	  if (functions)
+	    bnf_compile_functions();
+	  else
+	    bnf_compile();
 	  return (0);
 	}
 	if (!isatty(fileno(stdout)))
@@ -1001,12 +5220,14 @@ int main(int argc, char **argv)
     if (*source == 0)
       continue;
 
-    /* Set up and parse input to output. If successful execute parse */
+    /* Set up and parse input to output. If successful execute parse.
+       The grammar may have changed since the last line */
     input = source;
     output = code;
     if (!compile && !isatty(fileno(inf)))
       printf("# %s\n", source);
-    if (parse_input(main_symbol, &input, &output)) {
+    parse_prepare(main_symbol);
+    if (parse_input(&parser, main_symbol, &input, &output)) {
       env.sp = stack;
       env.ip = code;
       parse_execute(&env);
@@ -1016,13 +5237,13 @@ int main(int argc, char **argv)
       else if (!strcmp(source, "!bnf"))
 	main_symbol = &symbol_bnf;
       else {
-	if (isatty(fileno(inf)) && !parse_tracing && !parse_warning) {
+	if (isatty(fileno(inf)) && !parse_tracing && !parser.warning) {
 	  int n = strlen(main_symbol->name) + 2;
 	  while (n--)
 	    putchar(' ');
 	} else 
 	  printf("%s\n", source);
-	parse_error();
+	parse_error(&parser);
       }
     }
   }
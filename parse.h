@@ -7,7 +7,10 @@
  *   General back-tracking top down parse machine. Supports meta grammar
  *   with terminal matching, symmetric non-terminals, zero or one, zero
  *   or many, and one or many non-terminals. Additional support for
- *   parse cutting and error signalling.
+ *   parse cutting, error signalling, packrat memoization, direct
+ *   left recursion, operator precedence, predictive LL(1) parsing,
+ *   Earley parsing, LALR(1) parsing of yacc grammars and a virtual
+ *   machine for compiled products.
  *
  * Copyright (C) 1984-1994, 2013, Mikael Patel.
  *
@@ -31,6 +34,8 @@
 #if !defined(PARSE_H)
 #define PARSE_H
 
+#include <setjmp.h>
+
 #if !defined(TRUE)
 #define TRUE (1)
 #define FALSE (0)
@@ -43,8 +48,19 @@ typedef struct SYMBOL *DICTIONARY;
 typedef struct STRING STRING;
 typedef struct VALUE VALUE;
 typedef struct ENVIRONMENT ENVIRONMENT;
+typedef struct PARSER PARSER;
+typedef struct MEMO MEMO;
+typedef struct LALR LALR;
+typedef struct FRAME FRAME;
+typedef struct DFA DFA;
+typedef struct LEXER LEXER;
+typedef struct TOKEN TOKEN;
+typedef struct TRIE TRIE;
+typedef struct STREAM STREAM;
+typedef struct VM VM;
+typedef struct KEYWORDS KEYWORDS;
 typedef void (*SEMANTIC)(ENVIRONMENT*);
-typedef int (*PARSE)(SYMBOL*, char**, VALUE**);
+typedef int (*PARSE)(PARSER*, SYMBOL*, char**, VALUE**);
 
 struct STRING {
   int count;
@@ -80,8 +96,12 @@ struct ENVIRONMENT {
   VALUE *sp;
   VALUE *ip;
   void *ep;
+  int executing;
 };
 
+/* FIRST set; one bit per input byte, byte zero is end of input */
+#define PARSE_FIRST_SIZE (256 / 8)
+
 struct SYMBOL {
   SYMBOL *next;
   char *name;
@@ -89,6 +109,33 @@ struct SYMBOL {
   PRODUCT *syntax;
   PARSE parse;
   SEMANTIC semantic;
+  DFA *dfa;
+  unsigned char first[PARSE_FIRST_SIZE];
+  unsigned char follow[PARSE_FIRST_SIZE];
+  int nullable;
+  int pure;
+  int prepared;
+  int analysis;
+  int conflict;
+  unsigned long *select;
+  unsigned char *predict;
+  TRIE *trie;
+  unsigned char *commit;
+  LALR *lalr;
+  VM *vm;
+  SYMBOL *origin;
+  int keyword;
+  KEYWORDS *keywords;
+  LEXER *lexer;
+};
+
+/* Regular expression terminal; transition table per byte class */
+struct DFA {
+  int states;
+  int classes;
+  unsigned char *map;
+  short *next;
+  unsigned char *accept;
 };
 
 typedef enum {
@@ -97,14 +144,95 @@ typedef enum {
   TERM_ZERO_OR_ONE_TYPE,
   TERM_ZERO_OR_MANY_TYPE,
   TERM_ONE_OR_MANY_TYPE,
+  TERM_LEFT_OPERATOR_TYPE,
+  TERM_RIGHT_OPERATOR_TYPE,
+  TERM_AND_PREDICATE_TYPE,
+  TERM_NOT_PREDICATE_TYPE,
   TERM_PRODUCT_END_TYPE	
 } TERM_TYPE;
 
+/* Lookahead terms; the symbol is parsed without consuming input */
+#define TERM_PREDICATE(type) \
+  ((type) == TERM_AND_PREDICATE_TYPE || (type) == TERM_NOT_PREDICATE_TYPE)
+
+/* Operator table terms; follow the operand and are parsed by
+   precedence climbing */
+#define TERM_OPERATOR(type) \
+  ((type) == TERM_LEFT_OPERATOR_TYPE || (type) == TERM_RIGHT_OPERATOR_TYPE)
+
+/* Terms of an inlined symbol report it when they fail at its start */
+#define TERM_ERROR(term) \
+  ((term)->error != NULL ? (term)->error : (term)->symbol)
+
 struct TERM {
   TERM_TYPE type;
   SYMBOL *symbol;
+  SYMBOL *error;
 };
 
+/* Parse context; one per concurrent parse */
+#define PARSE_MEMO_SIZE 1021
+#define PARSE_SPACE_SIZE 64
+
+struct PARSER {
+  SYMBOL *error_symbol;
+  char *error_input;
+  char *start_input;
+  char *input_end;
+  int input_short;
+  VALUE *start_output;
+  int indent;
+  int cutting;
+  int warning;
+  int overflow;
+  FRAME *frame;
+  int frame_size;
+  int frames;
+  KEYWORDS *keywords;
+  char *keyword_input;
+  char *keyword_end;
+  SYMBOL *keyword;
+  char *range_input;
+  LEXER *lexer;
+  TOKEN *token;
+  int tokens;
+  int token_size;
+  int *lexed;
+  int lexed_size;
+  char *space_input[PARSE_SPACE_SIZE];
+  char *space_end[PARSE_SPACE_SIZE];
+  jmp_buf catch_buf;
+  MEMO *memo_oldest;
+  MEMO *memo_newest;
+  char *memo_low;
+  int memo_count;
+  MEMO *memo[PARSE_MEMO_SIZE];
+};
+
+/* End of input. A match from start that runs into it is short; the
+   input of a stream may continue in the next chunk */
+#define parse_end(parser, ip) ((ip) >= (parser)->input_end)
+#define parse_short(parser, ip, start) \
+  (parse_end(parser, ip) ? ((ip) > (start) ? ((parser)->input_short = TRUE) : TRUE) : FALSE)
+
+/* Stream of records; the buffer holds the input from the start of
+   the record that is not yet parsed. A record longer than the limit
+   is an error. Records of a line stream end with a new line, which is
+   searched for from scan; the rest of a line that is too long is
+   skipped */
+#define PARSE_STREAM_MAX 65536
+struct STREAM {
+  SYMBOL *symbol;
+  char *buffer;
+  int size;
+  int start;
+  int count;
+  int scan;
+  int limit;
+  int lines;
+  int skip;
+  int end;
+};
 
 /* String print function */
 void string_print(STRING *str);
@@ -114,47 +242,106 @@ void value_print(VALUE *value);
 void value_bind(VALUE *value, VALUE **output);
 #define value_tos(env, v) (v = env->sp)
 #define value_push(env,v) (env->sp++, *env->sp = *v)
-#define value_pop(env,v) (v = env->sp, env->sp--, v) 
+#define value_pop(env,v) (v = env->sp--)
 
 /* Symbol functions */
 SYMBOL *symbol_lookup(char *name, int *id, int append, DICTIONARY *dictionary);
 void symbol_print_name(SYMBOL *symbol);
 void symbol_bind(SYMBOL *symbol, VALUE **output);
 
-/* Parse machine variables and functions */
-extern SYMBOL *parse_error_symbol;
-extern char *parse_error_input;
+/* Parse machine debug flags (shared by all parse contexts) */
 extern int parse_tracing;
 extern int parse_timing;
-extern int parse_warning;
-extern int parse_indent;
-extern int parse_cutting;
-extern int parse_executing;
+
+/* Maximum nesting depth of the virtual machine; zero for no limit */
+#define PARSE_DEPTH 10000
+extern int parse_depth;
+
+/* Maximum number of memoized results; zero for no limit. Results
+   before the position of a cut are dropped */
+#define PARSE_MEMO_MAX 4096
+extern int parse_memo_size;
+void parse_evict(PARSER *parser, char *input);
 
 /* Execute result of parse and error function */
 void parse_execute(ENVIRONMENT *env);
-void parse_error(void);
+void parse_error(PARSER *parser);
 
 /* Parse functions */
-int parse_symbol(SYMBOL *symbol, char **input, VALUE **output);
-int parse_syntax(SYMBOL *symbol, char **input, VALUE **output);
-int parse_undefined(SYMBOL *symbol, char **input, VALUE **output);
-int parse_empty(SYMBOL *symbol, char **input, VALUE **output);
-int parse_eoln(SYMBOL *symbol, char **input, VALUE **output);
-int parse_integer(SYMBOL *symbol, char **input, VALUE **output);
-int parse_float(SYMBOL *symbol, char **input, VALUE **output);
-int parse_string(SYMBOL *symbol, char **input, VALUE **output);
-int parse_identifier(SYMBOL *symbol, char **input, VALUE **output);
-int parse_token(SYMBOL *symbol, char **input, VALUE **output);
-int parse_nospace(SYMBOL *symbol, char **input, VALUE **output);
-int parse_space(SYMBOL *symbol, char **input, VALUE **output);
-int parse_cut(SYMBOL *symbol, char **input, VALUE **output);
-int parse_throw(SYMBOL *symbol, char **input, VALUE **output);
-int parse_run(SYMBOL *symbol, char **input, VALUE **output);
-int parse_pos(SYMBOL *symbol, char **input, VALUE **output);
-
-/* Top level parse function */
-int parse_input(SYMBOL *symbol, char **input, VALUE **output);
+int parse_symbol(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_syntax(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_predict(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_memo(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_left_recursive(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_operator(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_earley(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_lalr(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_vm(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_undefined(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_empty(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_eoln(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_integer(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_float(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_string(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_identifier(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_regex(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_dfa(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_token(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_nospace(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_space(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_cut(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_throw(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_run(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_pos(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+
+/* Lookahead predicate (and, not); true if the predicate holds */
+int parse_lookahead(PARSER *parser, TERM_TYPE type, SYMBOL *symbol, char *input, VALUE *output);
+
+/* Grammar analysis; FIRST/FOLLOW sets, product selection, LL(1) and
+   LALR(1). The symbols reachable from a start symbol are analysed by
+   parse_prepare before the start symbol is parsed. A symbol that is
+   changed, and the symbols that use it, are invalidated and analysed
+   again by the next parse_prepare. Symbols that are not prepared are
+   parsed by back-tracking through all products */
+void parse_prepare(SYMBOL *symbol);
+void parse_invalidate(SYMBOL *symbol);
+int parse_conflicts(SYMBOL *symbol);
+int parse_order(SYMBOL *symbol, int n);
+int parse_commit(SYMBOL *symbol, int n);
+
+/* Keyword terminals; identifier names matched as whole words */
+int parse_keyword(char *name);
+
+/* Keyword terminals; identifiers match a whole word in the input. The
+   table is built by the next parse_prepare of the symbol */
+void parse_keywords(SYMBOL *symbol);
+
+/* Regular expression terminals; compiled to a DFA, NULL if illegal */
+DFA *parse_regex_compile(char *pattern, int length);
+
+/* Lexer stage; tokens of each input position are scanned once. The
+   tables are built by the next parse_prepare of the symbol */
+void parse_lexer(SYMBOL *symbol);
+
+/* Top level parse functions; null terminated input or a span of
+   bytes [begin, end). parse_span returns the number of bytes parsed
+   or -1 if the parse failed */
+int parse_input(PARSER *parser, SYMBOL *symbol, char **input, VALUE **output);
+int parse_span(PARSER *parser, SYMBOL *symbol, char *begin, char *end, VALUE **output);
+
+/* Streaming parse; push chunks of input and parse one record of the
+   symbol per call. Pushing a zero length chunk after parse_stream_end
+   parses the rest of the stream; PARSE_END when only white space is
+   left. parse_stream_lines makes each line a record */
+#define PARSE_ERROR (-1)
+#define PARSE_NEED_MORE 0
+#define PARSE_DONE 1
+#define PARSE_END 2
+void parse_stream_open(STREAM *stream, SYMBOL *symbol);
+void parse_stream_lines(STREAM *stream);
+void parse_stream_end(STREAM *stream);
+void parse_stream_close(STREAM *stream);
+int parse_push(PARSER *parser, STREAM *stream, char *chunk, int length, VALUE **output);
 
 /* Primitive semantic action on values */
 extern void semantic_value_add(ENVIRONMENT*);
@@ -175,6 +362,7 @@ extern SYMBOL symbol_eoln;
 extern SYMBOL symbol_integer;
 extern SYMBOL symbol_float;
 extern SYMBOL symbol_string;
+extern SYMBOL symbol_regex;
 extern SYMBOL symbol_space;
 extern SYMBOL symbol_nospace;
 extern SYMBOL symbol_execute;
@@ -32,7 +32,11 @@
 #include <string.h>
 
 #include "parse.h"
+#if defined(TEST_GRAMMAR)
+#include TEST_GRAMMAR
+#else
 #include "test.g"
+#endif
 
 typedef struct VARIABLE VARIABLE;
 
@@ -124,7 +128,7 @@ void semantic_get(ENVIRONMENT *env)
     value_push(env, &variable->value);
   } else {
     printf("%s: undefined variable\n", name);
-    parse_executing = FALSE;
+    env->executing = FALSE;
   }
 }
 
@@ -144,18 +148,62 @@ void semantic_put(ENVIRONMENT *env)
   value_push(env, v);
 }
 
+/* Read the input in small chunks and push them to a line stream; each
+   complete line is parsed once and executed. Lines are limited to fit
+   the code */
+int stream(PARSER *parser)
+{
+  ENVIRONMENT env;
+  STREAM stream;
+  char chunk[16];
+  VALUE code[512];
+  VALUE *output;
+  VALUE stack[64];
+  int n, r;
+
+  parse_stream_open(&stream, &symbol_test);
+  parse_stream_lines(&stream);
+  stream.limit = 256;
+  do {
+    n = fread(chunk, 1, sizeof(chunk), stdin);
+    if (n == 0)
+      parse_stream_end(&stream);
+    for (output = code, r = parse_push(parser, &stream, chunk, n, &output);
+	 r == PARSE_DONE || r == PARSE_ERROR;
+	 output = code, r = parse_push(parser, &stream, NULL, 0, &output)) {
+      if (r == PARSE_DONE) {
+	env.sp = stack;
+	env.ip = code;
+	parse_execute(&env);
+      }
+      else {
+	printf("%.*s\n", (int) (parser->input_end - parser->start_input),
+	       parser->start_input);
+	parse_error(parser);
+      }
+    }
+  } while (r != PARSE_END);
+  parse_stream_close(&stream);
+  return (0);
+}
+
 int main(int argc, char **argv)
 {
+  PARSER parser;
   ENVIRONMENT env;
   char source[512];
-  char *input;
   VALUE code[128];
   VALUE *output;
   VALUE stack[64];
   VALUE *sp;
 
+  /* Analyse the grammar once before parsing; -s parses a stream */
+  parse_prepare(&symbol_test);
+  if (argc > 1 && !strcmp(argv[1], "-s"))
+    return (stream(&parser));
   for (;;) {
     char *s = source;
+    int n;
 
     /* Prompt for input */
     if (isatty(fileno(stdin)))
@@ -165,25 +213,25 @@ int main(int argc, char **argv)
     s = fgets(s, 512, stdin);
     if (s == NULL)
       return (0);
-    s[strlen(s) - 1] = 0;
+    n = strlen(s) - 1;
 
     /* Empty line then read again */
-    if (*source == 0)
+    if (n == 0)
       continue;
 
-    /* Set up and parse input to output. If successful execute parse */
-    input = source;
+    /* Parse the line in place, without the new line, to output. If
+       successful execute parse */
     output = code;
-    if (parse_input(&symbol_test, &input, &output)) {
+    if (parse_span(&parser, &symbol_test, source, source + n, &output) >= 0) {
       env.sp = stack;
       env.ip = code;
       parse_execute(&env);
     } else {
-      if (isatty(fileno(stdin)) && !parse_tracing && !parse_warning) {
+      if (isatty(fileno(stdin)) && !parse_tracing && !parser.warning) {
     	  printf("      ");
       } else 
-    	  printf("%s\n", source);
-      parse_error();
+    	  printf("%.*s\n", n, source);
+      parse_error(&parser);
     }
   }
 